@@ -0,0 +1,95 @@
+#include "baton.h"
+#include <algorithm>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr uint32_t kMinSpins = 16;
+constexpr uint32_t kMaxSpins = 1 << 14;
+
+// grows while spinning pays off and shrinks when the waiter ends up blocking
+thread_local uint32_t spinBudget = 1 << 8;
+
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+inline uint32_t* futexAddress(std::atomic<uint32_t>& word) noexcept {
+  return reinterpret_cast<uint32_t*>(&word);
+}
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected, const timespec* timeout = nullptr) noexcept {
+  syscall(SYS_futex, futexAddress(word), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>& word) noexcept {
+  syscall(SYS_futex, futexAddress(word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}
+
+
+void Baton::post() noexcept {
+  if (state_.exchange(Posted, std::memory_order_acq_rel) == Waiting) {
+    futexWake(state_);
+  }
+}
+
+bool Baton::spinWait() noexcept {
+  for (uint32_t i = 0; i < spinBudget; ++i) {
+    if (ready()) {
+      spinBudget = std::min(spinBudget * 2, kMaxSpins);
+      return true;
+    }
+    cpuRelax();
+  }
+  spinBudget = std::max(spinBudget / 2, kMinSpins);
+  return false;
+}
+
+void Baton::wait() noexcept {
+  if (ready() || spinWait()) {
+    return;
+  }
+
+  uint32_t expected = Init;
+  if (!state_.compare_exchange_strong(expected, Waiting, std::memory_order_acq_rel) &&
+      expected == Posted) {
+    return;
+  }
+  while (state_.load(std::memory_order_acquire) != Posted) {
+    futexWait(state_, Waiting);
+  }
+}
+
+bool Baton::tryWaitUntil(std::chrono::steady_clock::time_point deadline) noexcept {
+  if (ready() || spinWait()) {
+    return true;
+  }
+
+  uint32_t expected = Init;
+  if (!state_.compare_exchange_strong(expected, Waiting, std::memory_order_acq_rel) &&
+      expected == Posted) {
+    return true;
+  }
+  while (state_.load(std::memory_order_acquire) != Posted) {
+    auto remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero()) {
+      return false;
+    }
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining - seconds);
+    timespec timeout{static_cast<time_t>(seconds.count()), static_cast<long>(nanoseconds.count())};
+    futexWait(state_, Waiting, &timeout);
+  }
+  return true;
+}
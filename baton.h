@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+// One-shot binary semaphore built on a futex. post() is called at most once,
+// wait() spins for a short, adaptively sized while and then sleeps in the
+// kernel until post() is called.
+class Baton {
+public:
+  Baton() noexcept : state_(Init) {}
+
+  Baton(const Baton&) = delete;
+  Baton& operator=(const Baton&) = delete;
+
+  void post() noexcept;
+  void wait() noexcept;
+
+  // Returns false if the baton was not posted before the deadline. The baton
+  // may still be waited on again afterwards.
+  template <class Clock, class Duration>
+  bool try_wait_until(const std::chrono::time_point<Clock, Duration>& deadline) noexcept {
+    auto remaining = deadline - Clock::now();
+    return tryWaitUntil(std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(remaining));
+  }
+
+  template <class Rep, class Period>
+  bool try_wait_for(const std::chrono::duration<Rep, Period>& d) noexcept {
+    return tryWaitUntil(std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(d));
+  }
+
+  bool ready() const noexcept {
+    return state_.load(std::memory_order_acquire) == Posted;
+  }
+
+private:
+  enum : uint32_t {
+    Init = 0,
+    Waiting = 1,
+    Posted = 2,
+  };
+
+  bool spinWait() noexcept;
+  bool tryWaitUntil(std::chrono::steady_clock::time_point deadline) noexcept;
+
+  std::atomic<uint32_t> state_;
+};
@@ -0,0 +1,313 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "core.h"
+#include "core-allocator.h"
+#include "promise.h"
+#include "future.h"
+#include "work-stealing-executor.h"
+#include "timekeeper.h"
+#include "counting-new.h"
+
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedNs(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+
+constexpr int kSpawnTreeDepth = 18;
+constexpr size_t kSpawnTreeTasks = (size_t(1) << (kSpawnTreeDepth + 1)) - 2;
+constexpr int kFanOut = 100000;
+
+// Every task spawns two children until `depth` reaches zero, so almost all
+// work is scheduled from inside the pool.
+static void spawnTree(Executor& executor, int depth, std::atomic<size_t>& leaves) {
+  if (depth == 0) {
+    leaves.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    executor.add([&executor, depth, &leaves] {
+      spawnTree(executor, depth - 1, leaves);
+    });
+  }
+}
+
+static void benchmarkSpawnTree(Executor& executor, const char* name) {
+  std::atomic<size_t> leaves{0};
+  auto start = Clock::now();
+  spawnTree(executor, kSpawnTreeDepth, leaves);
+  while (leaves.load(std::memory_order_relaxed) != (size_t(1) << kSpawnTreeDepth)) {
+    std::this_thread::yield();
+  }
+  std::cout<<name<<" spawn tree: "<<elapsedNs(start) / kSpawnTreeTasks<<" ns/task"<<std::endl;
+}
+
+// Thousands of futures continued on the executor and joined with collectAll.
+static void benchmarkFanOut(Executor& executor, const char* name) {
+  constexpr int n = kFanOut;
+  std::vector<Promise<int>> promises;
+  std::vector<Future<int>> futures;
+  promises.reserve(n);
+  futures.reserve(n);
+  for (int i = 0; i < n; i++) {
+    auto [p, f] = makePromiseContract<int>();
+    promises.push_back(std::move(p));
+    futures.push_back(std::move(f).thenOn(&executor, [](int v) {
+      unsigned x = v;
+      for (unsigned j = 0; j < 100; j++) {
+        x = x * 31 + j;
+      }
+      return int(x & 0xffff);
+    }));
+  }
+
+  auto start = Clock::now();
+  auto all = collectAll(std::move(futures));
+  for (int i = 0; i < n; i++) {
+    promises[i].setValue(int(i));
+  }
+  std::move(all).get();
+  std::cout<<name<<" collectAll fan-out: "<<elapsedNs(start) / n<<" ns/future"<<std::endl;
+}
+
+// collectAll over inputs that complete inline, the allocations counted start
+// after the input cores exist.
+static void benchmarkCollectAll() {
+  constexpr size_t n = 1000000;
+  std::vector<Promise<size_t>> promises;
+  std::vector<Future<size_t>> futures;
+  promises.reserve(n);
+  futures.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    auto [p, f] = makePromiseContract<size_t>();
+    promises.push_back(std::move(p));
+    futures.push_back(std::move(f));
+  }
+
+  auto before = allocations.load();
+  auto start = Clock::now();
+  auto all = collectAll(std::move(futures));
+  for (size_t i = 0; i < n; i++) {
+    promises[i].setValue(size_t(i));
+  }
+  auto results = std::move(all).get();
+  auto ns = elapsedNs(start);
+  auto allocated = allocations.load() - before;
+  std::cout<<"collectAll of "<<n<<": "<<ns / n<<" ns/input, "
+           <<allocated<<" allocations"<<std::endl;
+  if (results.size() != n || results[n - 1] != n - 1) {
+    std::cout<<"collectAll returned a wrong result"<<std::endl;
+  }
+}
+
+// A large payload counting how often it is moved or copied.
+struct Payload {
+  static size_t moves;
+  static size_t copies;
+
+  Payload() = default;
+  explicit Payload(size_t n) : data(n, std::string(64, 'x')) {}
+  Payload(Payload&& other) noexcept : data(std::move(other.data)) { moves++; }
+  Payload(const Payload& other) : data(other.data) { copies++; }
+  Payload& operator=(Payload&& other) noexcept {
+    data = std::move(other.data);
+    moves++;
+    return *this;
+  }
+
+  std::vector<std::string> data;
+};
+
+size_t Payload::moves = 0;
+size_t Payload::copies = 0;
+
+static void benchmarkMovesPerStage() {
+  constexpr size_t stages = 8;
+  Payload::moves = 0;
+  auto [p, f] = makePromiseContract<Payload>();
+  for (size_t i = 0; i < stages; i++) {
+    f = std::move(f).then([](Payload&& v) { return std::move(v); });
+  }
+  // constructed in the first core, every stage runs inline
+  p.emplaceValue(1000);
+  auto chained = Payload::moves;
+  Payload result;
+  std::move(f).getInto(result);
+  std::cout<<"then chain: "<<double(chained) / stages<<" moves/stage, "
+           <<Payload::copies<<" copies, "<<Payload::moves - chained
+           <<" moves in getInto()"<<std::endl;
+}
+
+// Short then() chains that create and destroy cores as fast as possible. An
+// arena is reset after every batch, as it would be after every request.
+static void benchmarkCoreAllocator(CoreAllocator* allocator, const char* name, CoreArena* arena = nullptr) {
+  constexpr size_t n = 1000000;
+  constexpr size_t batch = 100;
+  auto previous = setCoreAllocator(allocator);
+  auto before = allocations.load();
+  auto start = Clock::now();
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    {
+      auto [p, f] = makePromiseContract<size_t>();
+      auto g = std::move(f).then([](size_t v) { return v + 1; });
+      p.setValue(size_t(i));
+      sum += std::move(g).get();
+    }
+    // the chain's cores are gone by now
+    if (arena && i % batch == batch - 1) {
+      arena->reset();
+    }
+  }
+  auto ns = elapsedNs(start);
+  std::cout<<name<<" cores: "<<ns / n<<" ns/chain, "
+           <<double(allocations.load() - before) / n<<" allocations/chain"<<std::endl;
+  setCoreAllocator(previous);
+  if (sum != n * (n + 1) / 2) {
+    std::cout<<"wrong sum"<<std::endl;
+  }
+}
+
+// Cache-hit style chains on an already ready future, every continuation
+// runs on the spot.
+static void benchmarkReadyChain() {
+  constexpr size_t n = 1000000;
+  auto before = allocations.load();
+  auto start = Clock::now();
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += makeFuture(size_t(i))
+        .then([](size_t v) { return v + 1; })
+        .then([](size_t v) { return v * 2; })
+        .get();
+  }
+  auto ns = elapsedNs(start);
+  std::cout<<"ready then chain: "<<ns / n<<" ns/chain, "
+           <<double(allocations.load() - before) / n<<" allocations/chain"<<std::endl;
+  if (sum != n * (n + 1)) {
+    std::cout<<"wrong sum"<<std::endl;
+  }
+}
+
+// One promise handing its value to the next through a then() callback, every
+// core touched by one thread. Measures the bare cost of the core protocol.
+static void benchmarkPingPong() {
+  constexpr size_t n = 1000000;
+  auto start = Clock::now();
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    auto [ping, pingF] = makePromiseContract<size_t>();
+    auto [pong, pongF] = makePromiseContract<size_t>();
+    std::move(pingF).then([&pong = pong](size_t v) { pong.setValue(v + 1); });
+    std::move(pongF).then([&sum](size_t v) { sum += v; });
+    ping.setValue(size_t(i));
+  }
+  std::cout<<"ping-pong, one thread: "<<elapsedNs(start) / n<<" ns/round trip"<<std::endl;
+  if (sum != n * (n + 1) / 2) {
+    std::cout<<"wrong sum"<<std::endl;
+  }
+}
+
+// The same between two threads blocking in get(), so the state word and the
+// result cross cores on every hop.
+static void benchmarkPingPongThreads() {
+  constexpr size_t n = 100000;
+  std::vector<Promise<size_t>> pings, pongs;
+  std::vector<Future<size_t>> pingFs, pongFs;
+  for (size_t i = 0; i < n; i++) {
+    auto [ping, pingF] = makePromiseContract<size_t>();
+    auto [pong, pongF] = makePromiseContract<size_t>();
+    pings.push_back(std::move(ping));
+    pingFs.push_back(std::move(pingF));
+    pongs.push_back(std::move(pong));
+    pongFs.push_back(std::move(pongF));
+  }
+
+  std::thread echo([&] {
+    for (size_t i = 0; i < n; i++) {
+      pongs[i].setValue(std::move(pingFs[i]).get() + 1);
+    }
+  });
+  auto start = Clock::now();
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    pings[i].setValue(size_t(i));
+    sum += std::move(pongFs[i]).get();
+  }
+  auto ns = elapsedNs(start);
+  echo.join();
+  std::cout<<"ping-pong, two threads: "<<ns / n<<" ns/round trip"<<std::endl;
+  if (sum != n * (n + 1) / 2) {
+    std::cout<<"wrong sum"<<std::endl;
+  }
+}
+
+// Outstanding timeouts far enough out that none fires during the run.
+static void benchmarkTimekeeper(Timekeeper& timekeeper, const char* name) {
+  constexpr size_t n = 200000;
+  std::vector<uint64_t> ids;
+  ids.reserve(n);
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < n; i++) {
+    auto delay = std::chrono::seconds(10) + std::chrono::microseconds((i * 7919) % 50000000);
+    ids.push_back(timekeeper.schedule(delay, [] {}));
+  }
+  std::cout<<name<<" schedule: "<<elapsedNs(start) / n<<" ns/timer"<<std::endl;
+
+  start = Clock::now();
+  for (auto id : ids) {
+    timekeeper.cancel(id);
+  }
+  std::cout<<name<<" cancel: "<<elapsedNs(start) / n<<" ns/timer"<<std::endl;
+}
+
+
+int main(){
+  auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+  {
+  // room for every task, a full queue would run them inline in add()
+  ThreadPoolExecutor executor(threads, std::max(kSpawnTreeTasks, size_t(kFanOut)));
+  benchmarkSpawnTree(executor, "mutex+condvar pool");
+  benchmarkFanOut(executor, "mutex+condvar pool");
+  }
+  {
+  WorkStealingExecutor executor(threads);
+  benchmarkSpawnTree(executor, "work-stealing pool");
+  benchmarkFanOut(executor, "work-stealing pool");
+  }
+  benchmarkCollectAll();
+  benchmarkCoreAllocator(nullptr, "global new");
+  {
+  CorePool pool;
+  benchmarkCoreAllocator(&pool, "slab pool");
+  WorkStealingExecutor executor(threads);
+  setCoreAllocator(&pool);
+  benchmarkFanOut(executor, "work-stealing pool, slab pool");
+  setCoreAllocator(nullptr);
+  }
+  {
+  CoreArena arena;
+  benchmarkCoreAllocator(&arena, "arena", &arena);
+  }
+  benchmarkMovesPerStage();
+  benchmarkReadyChain();
+  benchmarkPingPong();
+  benchmarkPingPongThreads();
+  {
+  ThreadTimekeeper timekeeper;
+  benchmarkTimekeeper(timekeeper, "map timekeeper");
+  }
+  {
+  WheelTimekeeper timekeeper;
+  benchmarkTimekeeper(timekeeper, "timing wheel");
+  }
+  return 0;
+}
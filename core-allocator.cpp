@@ -0,0 +1,276 @@
+#include "core-allocator.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+
+namespace {
+
+std::atomic<CoreAllocator*> globalAllocator{nullptr};
+thread_local CoreAllocator* scopedAllocator = nullptr;
+
+std::atomic<uint64_t> nextPoolId{1};
+
+}
+
+
+CoreAllocator* getCoreAllocator() noexcept {
+  if (scopedAllocator) {
+    return scopedAllocator;
+  }
+  return globalAllocator.load(std::memory_order_acquire);
+}
+
+CoreAllocator* setCoreAllocator(CoreAllocator* allocator) noexcept {
+  return globalAllocator.exchange(allocator, std::memory_order_acq_rel);
+}
+
+CoreAllocatorScope::CoreAllocatorScope(CoreAllocator* allocator) noexcept
+    : previous_(std::exchange(scopedAllocator, allocator)) {}
+
+CoreAllocatorScope::~CoreAllocatorScope() {
+  scopedAllocator = previous_;
+}
+
+
+struct CorePool::Cache {
+  // only touched by the owning thread
+  std::array<Block*, kClasses> free{};
+  std::array<char*, kClasses> next{};
+  std::array<char*, kClasses> end{};
+  std::vector<void*> slabs;
+  // pushed to by other threads, taken over whole by the owner
+  std::array<std::atomic<Block*>, kClasses> remote{};
+  // cleared when the owning thread exits, set again under the pool's mutex
+  // by the thread adopting the cache
+  std::atomic<bool> owned = {true};
+};
+
+// The caches of the calling thread, one per pool it used. The pools own the
+// caches, an entry outlives its pool until it is pruned.
+struct CorePool::ThreadCaches {
+  struct Entry {
+    uint64_t pool;
+    // only used by the pool itself, which keeps it alive
+    Cache* cache;
+    std::weak_ptr<Cache> weak;
+  };
+  std::vector<Entry> entries;
+
+  ~ThreadCaches() {
+    for (auto& entry : entries) {
+      if (auto cache = entry.weak.lock()) {
+        cache->owned.store(false, std::memory_order_release);
+      }
+    }
+    current() = tornDown();
+  }
+
+  // drops the entries of destroyed pools
+  void prune() {
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry) {
+      return entry.weak.expired();
+    }), entries.end());
+  }
+
+  // trivially destructible, so it can still be read while thread locals are
+  // being destroyed
+  static ThreadCaches*& current() noexcept {
+    static thread_local ThreadCaches* caches = nullptr;
+    return caches;
+  }
+  static ThreadCaches* tornDown() noexcept {
+    return reinterpret_cast<ThreadCaches*>(uintptr_t(1));
+  }
+};
+
+
+CorePool::CorePool()
+    : id_(nextPoolId.fetch_add(1, std::memory_order_relaxed)) {}
+
+CorePool::~CorePool() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& cache : caches_) {
+    for (auto* slab : cache->slabs) {
+      ::operator delete(slab, std::align_val_t(kSlabSize));
+    }
+    cache->slabs.clear();
+  }
+}
+
+
+std::size_t CorePool::sizeClass(std::size_t size) noexcept {
+  std::size_t cls = 0;
+  for (auto classSize = kMinClass; classSize < size && cls < kClasses; classSize <<= 1) {
+    cls++;
+  }
+  return cls;
+}
+
+
+CorePool::ThreadCaches* CorePool::threadCaches(bool create) {
+  auto*& current = ThreadCaches::current();
+  if (current == ThreadCaches::tornDown()) {
+    return nullptr;
+  }
+  if (!current && create) {
+    static thread_local ThreadCaches caches;
+    current = &caches;
+  }
+  return current;
+}
+
+
+CorePool::Cache* CorePool::findLocalCache() const noexcept {
+  auto* caches = threadCaches(false);
+  if (!caches) {
+    return nullptr;
+  }
+  for (auto& entry : caches->entries) {
+    if (entry.pool == id_) {
+      return entry.cache;
+    }
+  }
+  return nullptr;
+}
+
+
+CorePool::Cache* CorePool::localCache() {
+  if (auto* cache = findLocalCache()) {
+    return cache;
+  }
+  auto* caches = threadCaches(true);
+  if (!caches) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<Cache> cache;
+  for (auto& candidate : caches_) {
+    if (candidate.get() != shared_ && !candidate->owned.load(std::memory_order_acquire)) {
+      cache = candidate;
+      cache->owned.store(true, std::memory_order_relaxed);
+      break;
+    }
+  }
+  if (!cache) {
+    cache = std::make_shared<Cache>();
+    caches_.push_back(cache);
+  }
+  caches->prune();
+  caches->entries.push_back({id_, cache.get(), cache});
+  return cache.get();
+}
+
+
+void* CorePool::allocate(std::size_t size) {
+  auto cls = sizeClass(size);
+  if (cls == kClasses) {
+    return ::operator new(size, std::align_val_t(kCoreAlignment));
+  }
+  if (auto* cache = localCache()) {
+    return pop(*cache, cls);
+  }
+
+  // the thread is exiting, share one cache that is never adopted
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!shared_) {
+    caches_.push_back(std::make_shared<Cache>());
+    shared_ = caches_.back().get();
+  }
+  return pop(*shared_, cls);
+}
+
+
+void* CorePool::pop(Cache& cache, std::size_t cls) {
+  auto* block = cache.free[cls];
+  if (!block) {
+    block = cache.remote[cls].exchange(nullptr, std::memory_order_acquire);
+  }
+  if (block) {
+    cache.free[cls] = block->next;
+    return block;
+  }
+
+  auto classSize = kMinClass << cls;
+  if (cache.next[cls] + classSize > cache.end[cls]) {
+    auto* memory = static_cast<char*>(::operator new(kSlabSize, std::align_val_t(kSlabSize)));
+    cache.slabs.push_back(memory);
+    reinterpret_cast<Slab*>(memory)->owner = &cache;
+    // the header takes the first block
+    cache.next[cls] = memory + classSize;
+    cache.end[cls] = memory + kSlabSize;
+  }
+  auto* p = cache.next[cls];
+  cache.next[cls] += classSize;
+  return p;
+}
+
+
+void CorePool::deallocate(void* p, std::size_t size) noexcept {
+  auto cls = sizeClass(size);
+  if (cls == kClasses) {
+    ::operator delete(p, std::align_val_t(kCoreAlignment));
+    return;
+  }
+
+  auto* block = static_cast<Block*>(p);
+  auto* owner = reinterpret_cast<Slab*>(uintptr_t(p) & ~uintptr_t(kSlabSize - 1))->owner;
+  if (owner == findLocalCache()) {
+    block->next = owner->free[cls];
+    owner->free[cls] = block;
+    return;
+  }
+
+  auto* head = owner->remote[cls].load(std::memory_order_relaxed);
+  do {
+    block->next = head;
+  } while (!owner->remote[cls].compare_exchange_weak(
+      head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+
+CoreArena::CoreArena(std::size_t chunkSize) : chunkSize_(chunkSize) {}
+
+CoreArena::~CoreArena() {
+  reset();
+}
+
+
+void* CoreArena::allocate(std::size_t size) {
+  size = (size + kCoreAlignment - 1) & ~(kCoreAlignment - 1);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!next_ || next_ + size > end_) {
+    auto chunkSize = std::max(chunkSize_, size);
+    next_ = static_cast<char*>(::operator new(chunkSize, std::align_val_t(kCoreAlignment)));
+    end_ = next_ + chunkSize;
+    chunks_.push_back(next_);
+  }
+  live_.fetch_add(1, std::memory_order_relaxed);
+  return std::exchange(next_, next_ + size);
+}
+
+
+void CoreArena::deallocate(void*, std::size_t) noexcept {
+  // release the destroyed core to reset()
+  live_.fetch_sub(1, std::memory_order_release);
+}
+
+
+void CoreArena::reset() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (live_.load(std::memory_order_acquire) != 0) {
+    // freeing the chunks under live cores would corrupt memory, in release
+    // builds too
+    std::fputs("CoreArena::reset() with live cores\n", stderr);
+    std::abort();
+  }
+  for (auto* chunk : chunks_) {
+    ::operator delete(chunk, std::align_val_t(kCoreAlignment));
+  }
+  chunks_.clear();
+  next_ = end_ = nullptr;
+}
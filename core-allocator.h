@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Cores start on a cache line boundary, allocators must align their memory to
+// it.
+constexpr std::size_t kCoreAlignment = 64;
+
+// Supplies the memory of Core objects, aligned to kCoreAlignment. A core
+// remembers the allocator it came from and hands its memory back to it,
+// whichever thread drops it last.
+class CoreAllocator {
+public:
+  virtual ~CoreAllocator() {}
+
+  virtual void* allocate(std::size_t size) = 0;
+  virtual void deallocate(void* p, std::size_t size) noexcept = 0;
+};
+
+// The allocator for cores created on this thread: the one of the innermost
+// CoreAllocatorScope, else the global one. nullptr means global new.
+CoreAllocator* getCoreAllocator() noexcept;
+
+// Sets the global allocator and returns the previous one. Cores already
+// allocated are unaffected, the allocator must outlive them.
+CoreAllocator* setCoreAllocator(CoreAllocator* allocator) noexcept;
+
+// Routes the cores created on this thread to `allocator` while in scope.
+class CoreAllocatorScope {
+public:
+  explicit CoreAllocatorScope(CoreAllocator* allocator) noexcept;
+  ~CoreAllocatorScope();
+
+  CoreAllocatorScope(const CoreAllocatorScope&) = delete;
+  CoreAllocatorScope& operator=(const CoreAllocatorScope&) = delete;
+
+private:
+  CoreAllocator* previous_;
+};
+
+
+// Size-class slab pool. Every thread carves blocks out of slabs of its own
+// cache and recycles them through a free list without atomics. A block
+// dropped by another thread goes onto a lock-free remote list of the cache
+// that owns its slab, which the owner takes over in one exchange once its
+// local list runs dry. Caches of exited threads are adopted by new ones.
+// Blocks are multiples of kMinClass into slabs aligned to their size, so
+// aligned to kCoreAlignment. Requests larger than the biggest size class go
+// to global new.
+class CorePool : public CoreAllocator {
+public:
+  CorePool();
+  // All cores allocated from the pool must be gone. Frees the caches of every
+  // thread that used the pool, the threads prune their entries for it later.
+  ~CorePool() override;
+
+  CorePool(const CorePool&) = delete;
+  CorePool& operator=(const CorePool&) = delete;
+
+  void* allocate(std::size_t size) override;
+  void deallocate(void* p, std::size_t size) noexcept override;
+
+  static constexpr std::size_t kSlabSize = 64 * 1024;
+  static constexpr std::size_t kMinClass = 64;
+  static constexpr std::size_t kClasses = 4; // 64, 128, 256 and 512 bytes
+  static_assert(kMinClass % kCoreAlignment == 0, "blocks must stay aligned");
+
+private:
+  struct Block {
+    Block* next;
+  };
+  struct Cache;
+  struct ThreadCaches;
+  // at the start of every slab, which is aligned to its size
+  struct Slab {
+    Cache* owner;
+  };
+
+  static std::size_t sizeClass(std::size_t size) noexcept;
+  // nullptr once the calling thread's thread locals are being destroyed
+  static ThreadCaches* threadCaches(bool create);
+  Cache* localCache();
+  Cache* findLocalCache() const noexcept;
+  static void* pop(Cache& cache, std::size_t cls);
+
+  const uint64_t id_;
+  std::mutex mutex_;
+  // every cache created for the pool, they own the slabs
+  std::vector<std::shared_ptr<Cache>> caches_;
+  // used under mutex_ by threads that are exiting
+  Cache* shared_ = nullptr;
+};
+
+
+// Bump allocator for the cores of one unit of work, e.g. a request. Cores are
+// destroyed one by one as usual but their memory is only given back in bulk
+// by reset() or the destructor. Thread safe.
+class CoreArena : public CoreAllocator {
+public:
+  explicit CoreArena(std::size_t chunkSize = 16 * 1024);
+  // All cores allocated from the arena must be gone.
+  ~CoreArena() override;
+
+  CoreArena(const CoreArena&) = delete;
+  CoreArena& operator=(const CoreArena&) = delete;
+
+  void* allocate(std::size_t size) override;
+  void deallocate(void* p, std::size_t size) noexcept override;
+
+  // Frees every chunk at once. All cores allocated from the arena must be
+  // gone, the process aborts otherwise.
+  void reset() noexcept;
+
+  std::size_t live() const noexcept { return live_.load(std::memory_order_relaxed); }
+
+private:
+  const std::size_t chunkSize_;
+  std::mutex mutex_;
+  std::vector<void*> chunks_;
+  char* next_ = nullptr;
+  char* end_ = nullptr;
+  std::atomic<std::size_t> live_ = {0};
+};
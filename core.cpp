@@ -1,19 +1,26 @@
 #include "core.h"
+#include "executor.h"
+#include <thread>
+
+
+CoreBase::~CoreBase() {
+  if (upstream_) {
+    upstream_->detachOne();
+  }
+  delete interrupt_;
+}
 
 
 bool CoreBase::hasCallback() const noexcept {
-  constexpr auto allowed = State::OnlyCallback | State::Done | State::Empty;
-  auto const state = state_.load(std::memory_order_acquire);
-  return State() != (state & allowed);
+  constexpr auto allowed = State::OnlyCallback | State::Done;
+  return State() != (state() & allowed);
 } 
 
 
 
 bool CoreBase::hasResult() const noexcept {
   constexpr auto allowed = State::OnlyResult | State::Done;
-  auto core = this;
-  auto state = core->state_.load(std::memory_order_acquire);
-  return State() != (state & allowed);
+  return State() != (state() & allowed);
 }
 
 bool CoreBase::ready() const noexcept {
@@ -25,20 +32,34 @@ void CoreBase::setResult_() {
   assert(!hasResult());
 
   auto state = state_.load(std::memory_order_acquire);
-  switch (state) {
-    case State::Start:
-      if (state_.compare_exchange_strong(state, State::OnlyResult, std::memory_order_release, std::memory_order_acquire)){
+  while (true) {
+    switch (state) {
+      case State::Start:
+        if (state_.compare_exchange_strong(state, State::OnlyResult, std::memory_order_release, std::memory_order_acquire)){
+          releaseUpstream();
+          return;
+        }
+        continue;
+      case State::Waiting:
+        if (state_.compare_exchange_strong(state, State::OnlyResult, std::memory_order_acq_rel, std::memory_order_acquire)){
+          releaseUpstream();
+          // the waiter cannot leave before it is posted, waiter_ is stable
+          waiter_->post();
+          return;
+        }
+        continue;
+      case State::OnlyCallback:
+        // release: whoever sees Done may read the result, not only the
+        // callback run below
+        state_.store(State::Done, std::memory_order_release);
+        releaseUpstream();
+        doCallback(state);
         return;
-      }
-    case State::OnlyCallback:
-      state_.store(State::Done, std::memory_order_relaxed);
-      doCallback(state);
-      return;
-    case State::OnlyResult:
-    case State::Done:
-    case State::Empty:
-    default:
-      throw std::logic_error("setResult unexpected state");
+      case State::OnlyResult:
+      case State::Done:
+      default:
+        throw std::logic_error("setResult unexpected state");
+    }
   }
 }
 
@@ -58,7 +79,8 @@ void CoreBase::setCallback_(Callback&& callback) {
   }
 
   if (state == State::OnlyResult) {
-    state_.store(State::Done, std::memory_order_relaxed);
+    // passes on the producer's release, a relaxed store would end it
+    state_.store(State::Done, std::memory_order_release);
     doCallback(state);
     return;
   }
@@ -67,9 +89,179 @@ void CoreBase::setCallback_(Callback&& callback) {
 }
 
 
+void CoreBase::wait() {
+  if (hasResult()) {
+    return;
+  }
+
+  Baton baton;
+  waiter_ = &baton;
+  auto state = State::Start;
+  if (state_.compare_exchange_strong(state, State::Waiting, std::memory_order_release, std::memory_order_acquire)) {
+    baton.wait();
+    return;
+  }
+  if (state != State::OnlyResult) {
+    throw std::logic_error("wait unexpected state");
+  }
+}
+
+
+bool CoreBase::waitUntil(std::chrono::steady_clock::time_point deadline) {
+  if (hasResult()) {
+    return true;
+  }
+
+  Baton baton;
+  waiter_ = &baton;
+  auto state = State::Start;
+  if (!state_.compare_exchange_strong(state, State::Waiting, std::memory_order_release, std::memory_order_acquire)) {
+    if (state != State::OnlyResult) {
+      throw std::logic_error("wait unexpected state");
+    }
+    return true;
+  }
+  if (baton.try_wait_until(deadline)) {
+    return true;
+  }
+
+  // timed out, take the waiter back out unless the producer got to it first
+  state = State::Waiting;
+  if (state_.compare_exchange_strong(state, State::Start, std::memory_order_acquire)) {
+    return false;
+  }
+  baton.wait();
+  return true;
+}
+
+
 void CoreBase::doCallback(State priorState) {
-  assert(state_ == State::Done);
+  assert(state() == State::Done);
+  if (!executor_) {
+    runCallback();
+    return;
+  }
+
+  // both sides may detach before the executor gets to run the callback
+  attachOne();
+  executor_->add([this] {
+    runCallback();
+    detachOne();
+  });
+}
+
+
+void CoreBase::runCallback() {
   callback_(*this);
   callback_.~Callback();
 }
 
+
+
+void CoreBase::detachOne() noexcept {
+  if (attached_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    destroy_(this);
+  }
+}
+
+
+void CoreBase::lockInterrupt() noexcept {
+  while (interruptLock_.exchange(true, std::memory_order_seq_cst)) {
+    std::this_thread::yield();
+  }
+}
+
+void CoreBase::unlockInterrupt() noexcept {
+  interruptLock_.store(false, std::memory_order_release);
+}
+
+bool CoreBase::hasResultLocked() const noexcept {
+  constexpr auto allowed = State::OnlyResult | State::Done;
+  return State() != (state_.load(std::memory_order_seq_cst) & allowed);
+}
+
+
+void CoreBase::raise(std::exception_ptr e) {
+  lockInterrupt();
+  if ((interrupt_ && interrupt_->exception) || hasResultLocked()) {
+    unlockInterrupt();
+    return;
+  }
+  if (!interrupt_) {
+    interrupt_ = new Interrupt;
+  }
+  interrupt_->exception = std::move(e);
+  auto* interrupt = interrupt_;
+  auto* upstream = upstream_;
+  if (upstream) {
+    upstream->attachOne();
+  }
+  unlockInterrupt();
+
+  // the handler is never replaced and the exception never written again, both
+  // are safe to use outside of the lock until the core is destroyed
+  if (interrupt->handler) {
+    interrupt->handler(interrupt->exception);
+  }
+  if (upstream) {
+    upstream->raise(interrupt->exception);
+    upstream->detachOne();
+  }
+}
+
+
+void CoreBase::setInterruptHandler(InterruptHandler&& handler) {
+  lockInterrupt();
+  if (interrupt_ && interrupt_->handler) {
+    unlockInterrupt();
+    throw std::logic_error("interrupt handler already set");
+  }
+  if (interrupt_ && interrupt_->exception) {
+    auto* interrupt = interrupt_;
+    unlockInterrupt();
+    handler(interrupt->exception);
+    return;
+  }
+  if (!interrupt_) {
+    interrupt_ = new Interrupt;
+  }
+  interrupt_->handler = std::move(handler);
+  unlockInterrupt();
+}
+
+
+void CoreBase::setUpstream(CoreBase* upstream) {
+  upstream->attachOne();
+  lockInterrupt();
+  if (hasResultLocked()) {
+    // too late to be interrupted, and releaseUpstream() may be running
+    unlockInterrupt();
+    upstream->detachOne();
+    return;
+  }
+  auto* previous = std::exchange(upstream_, upstream);
+  auto e = interrupt_ ? interrupt_->exception : nullptr;
+  unlockInterrupt();
+
+  if (previous) {
+    previous->detachOne();
+  }
+  if (e) {
+    upstream->raise(std::move(e));
+  }
+}
+
+
+void CoreBase::releaseUpstream() noexcept {
+  // Called once the result is set. raise() and setUpstream() check for it
+  // under the lock and leave upstream_ alone from then on, only wait out one
+  // that took the lock before. The fence orders the state written before
+  // against the lock read below, as taking the lock does the other way round.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (interruptLock_.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+  if (auto* upstream = std::exchange(upstream_, nullptr)) {
+    upstream->detachOne();
+  }
+}
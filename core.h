@@ -1,8 +1,15 @@
 #pragma once
-#include <functional>
 #include <cassert>
 #include <atomic>
+#include <chrono>
+#include <exception>
+#include <new>
 #include <utility>
+#include <stdexcept>
+#include "baton.h"
+#include "core-allocator.h"
+#include "function.h"
+#include "try.h"
 
 
 enum class State : uint8_t {
@@ -10,7 +17,7 @@ enum class State : uint8_t {
   OnlyResult = 1 << 1,
   OnlyCallback = 1 << 2,
   Done = 1 << 3,
-  Empty = 1 << 4,
+  Waiting = 1 << 4,
 };
 constexpr State operator&(State a, State b) {
   return State(uint8_t(a) & uint8_t(b));
@@ -26,16 +33,30 @@ constexpr State operator~(State a) {
 }
 
 
+class Executor;
+
+// The type independent part of a Core. There is no vtable, the Core<T> that
+// embeds it destroys it through destroy_.
+//
+// Layout: in a Core<T> the result comes first, followed by the fields that
+// are written once when the core is set up, then the atomics, and the
+// callback last. Cores are aligned to a cache line, for small T and the
+// default callback buffer the producer's result and the state share the
+// first line and the consumer's callback fills the second.
 class CoreBase {
 public:
-  using Callback = std::function<void(CoreBase&)>;
+  using Callback = Function<void(CoreBase&)>;
+  using InterruptHandler = Function<void(const std::exception_ptr&)>;
+  using DestroyFn = void (*)(CoreBase*) noexcept;
   CoreBase(const CoreBase&) = delete;
   CoreBase& operator=(const CoreBase&) = delete;
   CoreBase(CoreBase&&) = delete;
   CoreBase& operator=(CoreBase&&) = delete;
 
-  CoreBase(State state): state_(state){}
-  virtual ~CoreBase(){}
+  CoreBase(State state, uint16_t attached, DestroyFn destroy)
+      : destroy_(destroy), state_(state), attached_(attached) {}
+
+  State state() const noexcept { return state_.load(std::memory_order_acquire); }
 
   void setResult_();
   void setCallback_(Callback&& callback);
@@ -43,14 +64,70 @@ public:
   bool hasResult() const noexcept;
   bool ready() const noexcept;
   void doCallback(State priorState);
+  void runCallback();
+
+  // Blocks the calling thread until the core has a result. The consumer may
+  // wait instead of setting a callback, the result stays in the core.
+  void wait();
+  // Like wait(), returns false if there is no result by the deadline.
+  bool waitUntil(std::chrono::steady_clock::time_point deadline);
+
+  // Continuations run on this executor, or inline if it is null. Must be set
+  // before the callback is.
+  void setExecutor(Executor* executor) noexcept { executor_ = executor; }
+  Executor* getExecutor() const noexcept { return executor_; }
+
+  // The core is shared by at most one promise and one future. Each side
+  // holds one attach count and the core destroys itself once both are gone,
+  // giving its memory back to the allocator it came from.
+  void detachFuture() noexcept { detachOne(); }
+  void detachPromise() noexcept { detachOne(); }
+  void attachOne() noexcept { attached_.fetch_add(1, std::memory_order_relaxed); }
+  void detachOne() noexcept;
+
+  // Interrupts travel from the consumer to the producer. raise() records the
+  // first interrupt unless the core already has a result, runs the
+  // producer's handler and forwards it to the upstream core this one was
+  // chained from.
+  void raise(std::exception_ptr e);
+  // The handler runs at most once, immediately if an interrupt was already
+  // raised. May be set once.
+  void setInterruptHandler(InterruptHandler&& handler);
+  // Chains this core to the core whose completion will produce its result,
+  // holding an attach count on it until this core has a result.
+  void setUpstream(CoreBase* upstream);
+  void releaseUpstream() noexcept;
+
+protected:
+  ~CoreBase();
+
+  // allocated the first time either is set
+  struct Interrupt {
+    std::exception_ptr exception;
+    InterruptHandler handler;
+  };
 
+  void lockInterrupt() noexcept;
+  void unlockInterrupt() noexcept;
+  // hasResult() for raise() and setUpstream(), under the lock
+  bool hasResultLocked() const noexcept;
 
+  DestroyFn destroy_;
+  CoreAllocator* allocator_ = nullptr; // nullptr for global new
+  Executor* executor_ = nullptr;
+  // guarded by the interrupt lock
+  CoreBase* upstream_ = nullptr;
+  Interrupt* interrupt_ = nullptr;
 
+  // Together one word, but separate atomics: packed into a single atomic,
+  // every attach, detach and lock serialises with the state transitions.
+  std::atomic<State> state_;
+  std::atomic<bool> interruptLock_ = {false};
+  std::atomic<uint16_t> attached_;
   union {
     Callback callback_;
+    Baton* waiter_; // only while State::Waiting
   };
-  std::atomic<State> state_;
-
 };
 
 template <typename T>
@@ -60,32 +137,34 @@ protected:
   ~ResultHolder(){}
   
   union {
-    T result_;
+    Try<T> result_;
   };
 };
 
 
 template <typename T>
-class Core :private ResultHolder<T>, public CoreBase {
+class alignas(kCoreAlignment) Core :private ResultHolder<T>, public CoreBase {
 public:
   static_assert(!std::is_void<T>::value, "void futures are not supported, Use Unit instead.");
-  using Result = T; 
-  static Core* make() { return new Core(); }
-  static Core* make(T&& t) { return new Core(std::move(t)); }
+  using Result = Try<T>;
+  static Core* make() { return create(); }
+  static Core* make(T&& t) { return create(std::in_place, std::move(t)); }
+  static Core* make(Result&& t) { return create(std::move(t)); }
   template<typename ... Args>
   static Core* make(std::in_place_t, Args&&... args){
-    return new Core(std::in_place, std::forward<Args&&>(args)...);
+    return create(std::in_place, std::forward<Args&&>(args)...);
   }
 
-  T& get() {
+  Result& get() {
     assert(hasResult());
     return this->result_;
   }
-  const T& get() const {
-    static_assert(hasResult());
+  const Result& get() const {
+    assert(hasResult());
     return this->result_;
   }
 
+  // func is called with a Result&& referring to the core's storage
   template<typename F>
   void setCallback(F&& func){
     Callback callback = [func = static_cast<F&&>(func)](CoreBase& coreBase) mutable {
@@ -95,37 +174,108 @@ public:
     setCallback_(std::move(callback));
   }
 
-  void setResult(T&& t){
-    new (&this->result_)Result(std::move(t));
+  void setResult(Result&& t){
+    emplaceResult(std::move(t));
+  }
+
+  // Constructs the result in the core's storage from args, which are
+  // forwarded to a Result constructor.
+  template <typename... Args>
+  void emplaceResult(Args&&... args) {
+    new (&this->result_) Result(std::forward<Args>(args)...);
     setResult_();
   }
 
-  Core() : CoreBase(State::Start){}
-  explicit Core(T&& t) : CoreBase(State::OnlyResult){
+  // Constructs the result in place from the value returned by func, or from
+  // the exception it throws.
+  template <typename F>
+  void setResultWith(F&& func) {
+    try {
+      new (&this->result_) Result(TryInvokeTag(), static_cast<F&&>(func));
+    } catch (...) {
+      new (&this->result_) Result(std::current_exception());
+    }
+    setResult_();
+  }
+
+  // Until the result is set its storage is unused. A producer holding cores
+  // it has not fulfilled yet may link them into a list of its own through it,
+  // as SharedPromise does, instead of allocating nodes.
+  void setNextPending(Core* next) noexcept {
+    static_assert(sizeof(Result) >= sizeof(Core*) && alignof(Result) >= alignof(Core*),
+        "the result storage cannot hold a link");
+    assert(!hasResult());
+    ::new (static_cast<void*>(&this->result_)) Core*(next);
+  }
+  Core* nextPending() const noexcept {
+    assert(!hasResult());
+    return *std::launder(reinterpret_cast<Core* const*>(&this->result_));
+  }
+
+  Core() : CoreBase(State::Start, 2, &destroy){}
+  explicit Core(Result&& t) : CoreBase(State::OnlyResult, 1, &destroy){
     new (&this->result_) Result(std::move(t));
   }
   template<typename ... Args>
-  explicit Core(std::in_place_t, Args&& ... args) : CoreBase(State::OnlyResult){
+  explicit Core(std::in_place_t, Args&& ... args) : CoreBase(State::OnlyResult, 1, &destroy){
     new (&this->result_) Result(std::in_place, std::forward<Args&&>(args)...);
   }
-  ~Core() override {
-    auto state = state_.load(std::memory_order_relaxed);
-    switch (state) {
-      case State::OnlyResult:
-        [[fallthrought]]
+  // Cores are placed in memory from getCoreAllocator(), use make().
+  template <typename... Args>
+  static Core* create(Args&&... args) {
+    auto* allocator = getCoreAllocator();
+    void* memory = allocator ? allocator->allocate(sizeof(Core))
+                             : ::operator new(sizeof(Core), std::align_val_t(alignof(Core)));
+    Core* core;
+    try {
+      core = ::new (memory) Core(std::forward<Args>(args)...);
+    } catch (...) {
+      allocator ? allocator->deallocate(memory, sizeof(Core))
+                : ::operator delete(memory, std::align_val_t(alignof(Core)));
+      throw;
+    }
+    core->allocator_ = allocator;
+    return core;
+  }
 
+private:
+  static void destroy(CoreBase* base) noexcept {
+    auto* core = static_cast<Core*>(base);
+    auto* allocator = core->allocator_;
+    core->~Core();
+    if (allocator) {
+      allocator->deallocate(core, sizeof(Core));
+    } else {
+      ::operator delete(core, std::align_val_t(alignof(Core)));
+    }
+  }
+
+  ~Core() {
+    switch (state()) {
+      case State::OnlyResult:
       case State::Done:
         this->result_.~Result();
         break;
 
-      case State::Empty:
+      // the promise was dropped before its future was retrieved
+      case State::Start:
         break;
 
-      case State::Start:
       case State::OnlyCallback:
       default:
         throw std::logic_error("~Core unexpected state");
     }
   }
-  
 };
+
+
+static_assert(sizeof(CoreBase) == sizeof(CoreBase::Callback) + 6 * sizeof(void*),
+    "CoreBase has grown");
+static_assert(alignof(Core<int>) == kCoreAlignment &&
+    sizeof(Core<int>) == (sizeof(Try<int>) + sizeof(CoreBase) + kCoreAlignment - 1)
+        / kCoreAlignment * kCoreAlignment,
+    "Core<int> is padded beyond its last cache line");
+// the two line layout is only promised for the default callback buffer,
+// FUTURE_CALLBACK_INLINE_SIZE trades it for larger or smaller callbacks
+static_assert(kCallbackInlineSize != 48 || sizeof(Core<int>) == 2 * kCoreAlignment,
+    "Core<int> no longer fills two cache lines");
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cassert>
+#include <stdexcept>
+#include "core.h"
+#include "promise.h"
+#include "future.h"
+#include "task.h"
+#include "counting-new.h"
+
+
+static Task<int> add(int a, int b) {
+  co_return a + b;
+}
+
+static Task<int> fail() {
+  throw std::runtime_error("failed");
+  co_return 0;
+}
+
+// three steps written as straight line code instead of nested then() calls
+static Task<int> handle(Future<int> request) {
+  auto v = co_await std::move(request);
+  auto w = co_await add(v, 1);
+  auto x = co_await makeFuture(w * 2);
+  co_return x;
+}
+
+static Task<Unit> count(int& counter, int n) {
+  for (int i = 0; i < n; i++) {
+    counter += co_await add(i, 0) >= 0;
+  }
+  co_return;
+}
+
+static Task<int> recover() {
+  try {
+    co_await fail();
+  } catch (const std::runtime_error&) {
+    co_return -1;
+  }
+  co_return 0;
+}
+
+
+int main(){
+  {
+  // the coroutine suspends on the pending future and is resumed by the
+  // thread fulfilling it
+  auto [p, f] = makePromiseContract<int>();
+  Future<int> result = handle(std::move(f));
+  assert(!result.isReady());
+  std::thread t([p = std::move(p)] () mutable {
+    p.setValue(20);
+  });
+  assert(std::move(result).get() == 42);
+  t.join();
+  }
+
+  {
+  // exceptions travel through co_await like through then()
+  assert(recover().start().get() == -1);
+  auto f = fail().start();
+  assert(f.hasException());
+
+  auto [p, g] = makePromiseContract<int>();
+  auto h = handle(std::move(g)).start();
+  p.setException(std::logic_error("no request"));
+  assert(h.hasException());
+
+  int counter = 0;
+  count(counter, 10).start().get();
+  assert(counter == 10);
+  }
+
+  {
+  // once the frame pool is warm, nested tasks and ready futures allocate
+  // nothing; a started task allocates the core of its Future
+  for (int i = 0; i < 100; i++) {
+    handle(makeFuture(int(i))).start().get();
+  }
+  auto before = allocations.load();
+  assert(handle(makeFuture(20)).start().get() == 42);
+  std::cout<<"started task allocations: "<<allocations.load() - before<<std::endl;
+  assert(allocations.load() - before <= 1);
+  }
+
+  {
+  // a three step request, as a task and as a then() chain
+  constexpr int n = 200000;
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  long sum = 0;
+  for (int i = 0; i < n; i++) {
+    auto [p, f] = makePromiseContract<int>();
+    auto r = handle(std::move(f)).start();
+    p.setValue(int(i));
+    sum += std::move(r).get();
+  }
+  auto taskNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+
+  start = Clock::now();
+  for (int i = 0; i < n; i++) {
+    auto [p, f] = makePromiseContract<int>();
+    auto r = std::move(f).then([](int v) {
+      return add(v, 1).start();
+    }).then([](int w) {
+      return makeFuture(w * 2);
+    });
+    p.setValue(int(i));
+    sum -= std::move(r).get();
+  }
+  auto thenNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+  assert(sum == 0);
+  std::cout<<"task: "<<taskNs<<" ns/request, then chain: "<<thenNs<<" ns/request"<<std::endl;
+  }
+
+  std::cout<<"finished"<<std::endl;
+  return 0;
+}
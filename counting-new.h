@@ -0,0 +1,45 @@
+#pragma once
+// Counts the calls to global operator new, for the demos and benchmarks that
+// check what a path allocates. Replaces the global operators, so include it
+// from exactly one translation unit of an executable.
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+static std::atomic<size_t> allocations{0};
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  auto alignment = std::size_t(align);
+  // aligned_alloc() wants a multiple of the alignment
+  if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1))) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
@@ -0,0 +1,75 @@
+#include "executor.h"
+
+
+namespace {
+thread_local ThreadPoolExecutor* currentPool = nullptr;
+}
+
+
+InlineExecutor& InlineExecutor::instance() {
+  static InlineExecutor executor;
+  return executor;
+}
+
+
+ThreadPoolExecutor::ThreadPoolExecutor(size_t numThreads, size_t queueCapacity)
+    : capacity_(queueCapacity), stopping_(false) {
+  threads_.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i) {
+    threads_.emplace_back([this] { run(); });
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  join();
+}
+
+void ThreadPoolExecutor::add(Func func) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (currentPool != this) {
+      notFull_.wait(lock, [&] { return stopping_ || queue_.size() < capacity_; });
+    }
+    if (!stopping_ && queue_.size() < capacity_) {
+      queue_.push_back(std::move(func));
+      lock.unlock();
+      notEmpty_.notify_one();
+      return;
+    }
+  }
+  func();
+}
+
+void ThreadPoolExecutor::join() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+  }
+  notEmpty_.notify_all();
+  notFull_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void ThreadPoolExecutor::run() {
+  currentPool = this;
+  while (true) {
+    Func func;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      notEmpty_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      func = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    notFull_.notify_one();
+    func();
+  }
+}
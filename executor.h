@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "function.h"
+
+
+// Runs continuations. Implementations decide on which thread and when.
+class Executor {
+public:
+  using Func = Function<void()>;
+
+  virtual ~Executor() {}
+
+  virtual void add(Func func) = 0;
+};
+
+
+// Runs every function immediately on the calling thread.
+class InlineExecutor : public Executor {
+public:
+  static InlineExecutor& instance();
+
+  void add(Func func) override { func(); }
+};
+
+
+// Fixed number of threads consuming a bounded FIFO queue. add() blocks while
+// the queue is full so producers get backpressure, except when called from one
+// of the pool's own threads where the function runs inline instead of risking
+// a deadlock.
+class ThreadPoolExecutor : public Executor {
+public:
+  explicit ThreadPoolExecutor(size_t numThreads, size_t queueCapacity = 1024);
+  ~ThreadPoolExecutor() override;
+
+  ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+  ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+  void add(Func func) override;
+
+  // Stops accepting work, drains the queue and joins the threads. Functions
+  // added afterwards run inline.
+  void join();
+
+private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable notEmpty_;
+  std::condition_variable notFull_;
+  std::deque<Func> queue_;
+  size_t capacity_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+};
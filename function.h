@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+// Bytes of inline storage in a Function before a callable spills to the heap.
+// The default is sized for the lambdas built by FutureBase::thenImplementation
+// (a downstream promise plus a small user functor).
+#ifndef FUTURE_CALLBACK_INLINE_SIZE
+#define FUTURE_CALLBACK_INLINE_SIZE 48
+#endif
+
+constexpr std::size_t kCallbackInlineSize = FUTURE_CALLBACK_INLINE_SIZE;
+
+
+template <typename Sig, std::size_t InlineSize = kCallbackInlineSize>
+class Function;
+
+// Move-only type-erased callable. Callables that fit in InlineSize bytes and
+// are nothrow movable are stored in place, anything else is heap allocated.
+template <typename R, typename... Args, std::size_t InlineSize>
+class Function<R(Args...), InlineSize> {
+public:
+  Function() noexcept = default;
+  Function(std::nullptr_t) noexcept {}
+
+  template <
+      typename F,
+      typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Function>::value>>
+  Function(F&& func) {
+    using D = std::decay_t<F>;
+    if constexpr (fitsInline<D>()) {
+      ::new (static_cast<void*>(&storage_)) D(static_cast<F&&>(func));
+      ops_ = &inlineOps<D>;
+    } else {
+      ::new (static_cast<void*>(&storage_)) D*(new D(static_cast<F&&>(func)));
+      ops_ = &heapOps<D>;
+    }
+  }
+
+  Function(const Function&) = delete;
+  Function& operator=(const Function&) = delete;
+
+  Function(Function&& other) noexcept { moveFrom(other); }
+
+  Function& operator=(Function&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  ~Function() { reset(); }
+
+  R operator()(Args... args) {
+    return ops_->invoke(&storage_, static_cast<Args&&>(args)...);
+  }
+
+  explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+  // true if the callable lives in the inline buffer
+  bool isInline() const noexcept { return ops_ && ops_->inlined; }
+
+  void reset() noexcept {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  template <typename F>
+  static constexpr bool fitsInline() {
+    return sizeof(F) <= InlineSize &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<F>::value;
+  }
+
+private:
+  struct Ops {
+    R (*invoke)(void*, Args&&...);
+    // move constructs the callable into `to` and destroys the one in `from`
+    void (*relocate)(void* from, void* to) noexcept;
+    void (*destroy)(void*) noexcept;
+    bool inlined;
+  };
+
+  template <typename F>
+  static R invokeInline(void* p, Args&&... args) {
+    return (*static_cast<F*>(p))(static_cast<Args&&>(args)...);
+  }
+  template <typename F>
+  static void relocateInline(void* from, void* to) noexcept {
+    ::new (to) F(std::move(*static_cast<F*>(from)));
+    static_cast<F*>(from)->~F();
+  }
+  template <typename F>
+  static void destroyInline(void* p) noexcept {
+    static_cast<F*>(p)->~F();
+  }
+
+  template <typename F>
+  static R invokeHeap(void* p, Args&&... args) {
+    return (**static_cast<F**>(p))(static_cast<Args&&>(args)...);
+  }
+  static void relocateHeap(void* from, void* to) noexcept {
+    ::new (to) void*(*static_cast<void**>(from));
+  }
+  template <typename F>
+  static void destroyHeap(void* p) noexcept {
+    delete *static_cast<F**>(p);
+  }
+
+  template <typename F>
+  static constexpr Ops inlineOps{
+      &invokeInline<F>, &relocateInline<F>, &destroyInline<F>, true};
+  template <typename F>
+  static constexpr Ops heapOps{
+      &invokeHeap<F>, &relocateHeap, &destroyHeap<F>, false};
+
+  void moveFrom(Function& other) noexcept {
+    if (other.ops_) {
+      other.ops_->relocate(&other.storage_, &storage_);
+      ops_ = std::exchange(other.ops_, nullptr);
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[InlineSize];
+  const Ops* ops_ = nullptr;
+};
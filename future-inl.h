@@ -1,81 +1,184 @@
 #pragma once
+#include <algorithm>
 #include <memory>
-#include "semaphore.h"
+#include <mutex>
+#include <tuple>
 
 
-namespace detail {
-
-
-
-template <class FutureType, typename T = typename FutureType::value_type>
-void waitImpl(FutureType& f) {
-  // short-circuit if there's nothing to do
-  if (f.isReady()) {
-    return;
+template <class T>
+Future<T> makeFuture(T&& t) {
+  if constexpr (detail::FutureInlineResult<T>::enabled) {
+    return Future<T>(Try<T>(std::in_place, std::move(t)));
+  } else {
+    return Future<T>(Core<T>::make(std::move(t)));
   }
-
-  auto p = std::make_shared<Promise<T>>();
-  auto r = p->getFuture();
-
-  Semaphore semaphore;
-  f.setCallback_([&semaphore, p](T&& t) mutable {
-    p->setValue(std::move(t));
-    semaphore.notify();
-  });
-  f = std::move(r);
-  semaphore.wait();
-  assert(f.isReady());
 }
 
+template <class T>
+Future<T> makeFuture(Try<T>&& t) {
+  return Future<T>(std::move(t));
+}
 
+inline Future<Unit> makeFuture() {
+  return makeFuture(Unit{});
+}
 
+template <class T>
+Future<T> makeFuture(std::exception_ptr e) {
+  return makeFuture(Try<T>(std::move(e)));
+}
 
+template <class T, class E>
+typename std::enable_if<std::is_base_of<std::exception, E>::value, Future<T>>::type
+makeFuture(E const& e) {
+  return makeFuture<T>(std::make_exception_ptr(e));
 }
 
 template <class T>
-Future<T> makeFuture(T&& t) {
-  return Future<T>(std::shared_ptr<Core<T>>(Core<T>::make(std::move(t))));
+FutureBase<T>::FutureBase(Try<T>&& t) {
+  if constexpr (Inline::enabled) {
+    new (&this->ready_) Try<T>(std::move(t));
+    core_ = inlineTag();
+  } else {
+    core_ = Core<T>::make(std::move(t));
+  }
 }
 
 template <class T>
-FutureBase<T>::FutureBase(Future<T>&& other) noexcept : core_(other.core_) {
-  other.core_ = nullptr;
+FutureBase<T>::FutureBase(Future<T>&& other) noexcept : core_(nullptr) {
+  moveFrom(other);
 }
 
 
 template <class T>
 void FutureBase<T>::assign(FutureBase<T>&& other) noexcept {
+  if (this == &other) {
+    return;
+  }
+  detach();
+  moveFrom(other);
+}
+
+template <class T>
+void FutureBase<T>::moveFrom(FutureBase<T>& other) noexcept {
+  if constexpr (Inline::enabled) {
+    if (other.isInline()) {
+      new (&this->ready_) Try<T>(std::move(other.ready_));
+      other.ready_.~Try();
+      this->continued_ = std::exchange(other.continued_, false);
+    }
+  }
   core_ = std::exchange(other.core_, nullptr);
 }
 
+template <class T>
+void FutureBase<T>::detach() noexcept {
+  if constexpr (Inline::enabled) {
+    if (isInline()) {
+      this->ready_.~Try();
+      this->continued_ = false;
+      core_ = nullptr;
+      return;
+    }
+  }
+  if (core_) {
+    core_->detachFuture();
+    core_ = nullptr;
+  }
+}
+
+template <class T>
+Core<T>& FutureBase<T>::getCore() {
+  if constexpr (Inline::enabled) {
+    if (isInline()) {
+      // a core made now would take another callback
+      if (this->continued_) {
+        throw FutureAlreadyContinued();
+      }
+      auto* core = Core<T>::make(std::move(this->ready_));
+      this->ready_.~Try();
+      core_ = core;
+    }
+  }
+  return getCoreImpl(*this);
+}
+
 template <class T>
 FutureBase<T>::~FutureBase() {
+  detach();
 }
 
 template <class T>
 T& FutureBase<T>::value() & {
-  return getCoreValueChecked();
+  return getCoreTryChecked().value();
 }
 
 template <class T>
 T const& FutureBase<T>::value() const& {
-  return getCoreValueChecked();
+  return getCoreTryChecked().value();
 }
 
 template <class T>
 T&& FutureBase<T>::value() && {
-  return std::move(getCoreValueChecked());
+  return std::move(getCoreTryChecked().value());
 }
 
 template <class T>
 T const&& FutureBase<T>::value() const&& {
-  return std::move(getCoreValueChecked());
+  return std::move(getCoreTryChecked().value());
+}
+
+template <class T>
+Try<T>& FutureBase<T>::result() & {
+  return getCoreTryChecked();
+}
+
+template <class T>
+Try<T> const& FutureBase<T>::result() const& {
+  return getCoreTryChecked();
+}
+
+template <class T>
+Try<T>&& FutureBase<T>::result() && {
+  return std::move(getCoreTryChecked());
 }
 
 
 template <class T>
 bool FutureBase<T>::isReady() const {
-  return getCore().hasResult();
+  return isInline() || getCoreImpl(*this).hasResult();
+}
+
+template <class T>
+bool FutureBase<T>::isReadyInline() const {
+  if (isInline()) {
+    return true;
+  }
+  auto& core = getCoreImpl(*this);
+  return core.hasResult() && !core.getExecutor();
+}
+
+template <class T>
+bool FutureBase<T>::hasValue() const {
+  return getCoreTryChecked().hasValue();
+}
+
+template <class T>
+bool FutureBase<T>::hasException() const {
+  return getCoreTryChecked().hasException();
+}
+
+template <class T>
+Executor* FutureBase<T>::getExecutor() const {
+  return isInline() ? nullptr : getCoreImpl(*this).getExecutor();
+}
+
+template <class T>
+void FutureBase<T>::raise(std::exception_ptr e) {
+  // an inline result is there already, which makes the interrupt moot
+  if (!isInline()) {
+    getCore().raise(std::move(e));
+  }
 }
 
 template <class T>
@@ -87,6 +190,14 @@ void FutureBase<T>::throwIfInvalid() const {
 
 template <class T>
 void FutureBase<T>::throwIfContinued() const {
+  if constexpr (Inline::enabled) {
+    if (isInline()) {
+      if (this->continued_) {
+        throw FutureAlreadyContinued();
+      }
+      return;
+    }
+  }
   if (!core_ || core_->hasCallback()) {
     throw FutureAlreadyContinued();
   }
@@ -94,9 +205,8 @@ void FutureBase<T>::throwIfContinued() const {
 
 template <class T>
 std::optional<T> FutureBase<T>::poll() {
-  auto& core = getCore();
-  return core.hasResult() ? std::optional<T>(std::move(core.get()))
-                          : std::optional<T>();
+  return isReady() ? std::optional<T>(std::move(getCoreTryChecked()).value())
+                   : std::optional<T>();
 }
 
 
@@ -104,46 +214,126 @@ template <class T>
 template <class F>
 void FutureBase<T>::setCallback_(F&& func) {
   throwIfContinued();
+  if constexpr (Inline::enabled) {
+    if (isInline()) {
+      // run it on the result in place as a core would, what the callback
+      // leaves behind can still be read
+      this->continued_ = true;
+      static_cast<F&&>(func)(std::move(this->ready_));
+      return;
+    }
+  }
   getCore().setCallback(static_cast<F&&>(func));
 }
 
 
+template <class T>
+template <class B, class F>
+void FutureBase<T>::fulfillWithFuture(Promise<B>& p, F&& func) {
+  auto inner = makeTryWith(static_cast<F&&>(func));
+  if (inner.hasException()) {
+    p.setException(std::move(inner).exception());
+    return;
+  }
+  auto& future = inner.value();
+  if (future.isReadyInline()) {
+    // no need to give a ready result a core to link to
+    p.setTry(std::move(future).result());
+    return;
+  }
+  // p's result now comes from the inner future, so must its interrupts
+  p.getCore().setUpstream(&future.getCore());
+  future.setCallback_([p = std::move(p)](Try<B>&& b) mutable {
+    p.setTry(std::move(b));
+  });
+}
+
+
 // Variant: returns a value
-// e.g. f.then([](Try<T>&& t){ return t.value(); });
+// e.g. f.thenTry([](Try<T>&& t){ return t.value(); });
 template <class T>
 template <typename F, typename R>
 typename std::enable_if<!R::ReturnsFuture::value, typename R::Return>::type
 FutureBase<T>::thenImplementation(
     F&& func, R) {
   static_assert(R::Arg::ArgsSize::value == 1, "Then must take one arguments");
-  typedef typename R::ReturnsFuture::Inner B;
+  typedef typename R::value_type B;
+
+  if (isReadyInline()) {
+    // no promise, no callback: call func on the result where it is and
+    // return a ready future
+    throwIfContinued();
+    auto& t = getCoreTryChecked();
+    auto f = !R::isTry && t.hasException()
+        ? makeFuture<B>(std::move(t).exception())
+        : makeFuture(makeTryWith([&] { return static_cast<F&&>(func)(std::move(t)); }));
+    detach();
+    return f;
+  }
 
-  auto p = std::make_shared<Promise<B>>();
-  auto f = p->getFuture();
+  Promise<B> p;
+  auto f = p.getFuture();
+  f.getCore().setExecutor(getExecutor());
+  f.getCore().setUpstream(&getCore());
 
-  this->setCallback_([p, func = static_cast<F&&>(func)](T&& t) mutable {
-    p->setValue(std::move(static_cast<F&&>(func)(std::move(t))));
+  this->setCallback_([p = std::move(p), func = static_cast<F&&>(func)](Try<T>&& t) mutable {
+    if (!R::isTry && t.hasException()) {
+      p.setException(std::move(t).exception());
+    } else {
+      p.setWith([&] { return static_cast<F&&>(func)(std::move(t)); });
+    }
   });
 
-  return std::move(f);
+  return f;
 }
 
 // Variant: returns a Future
-// e.g. f.then([](T&& t){ return makeFuture<T>(t); });
+// e.g. f.thenTry([](Try<T>&& t){ return makeFuture<T>(t.value()); });
 template <class T>
 template <typename F, typename R>
 typename std::enable_if<R::ReturnsFuture::value, typename R::Return>::type
 FutureBase<T>::thenImplementation(
     F&& func, R) {
   static_assert(R::Arg::ArgsSize::value == 1, "Then must take one arguments");
-  typedef typename R::ReturnsFuture::Inner B;
-
+  typedef typename R::value_type B;
+
+  if (isReadyInline()) {
+    throwIfContinued();
+    auto& t = getCoreTryChecked();
+    if (!R::isTry && t.hasException()) {
+      auto f = makeFuture<B>(std::move(t).exception());
+      detach();
+      return f;
+    }
+    auto inner = makeTryWith([&] { return static_cast<F&&>(func)(std::move(t)); });
+    detach();
+    if (inner.hasException()) {
+      return makeFuture<B>(std::move(inner).exception());
+    }
+    // continuations of the returned future must not run on the inner
+    // future's executor, it cannot be returned as is then
+    if (!inner.value().getExecutor()) {
+      return std::move(inner).value();
+    }
+    Promise<B> p;
+    auto f = p.getFuture();
+    fulfillWithFuture(p, [&] { return std::move(inner).value(); });
+    return f;
+  }
 
-  auto p = std::make_shared<Promise<B>>();
-  auto f = p->getFuture();
+  Promise<B> p;
+  auto f = p.getFuture();
+  f.getCore().setExecutor(getExecutor());
+  f.getCore().setUpstream(&getCore());
 
-  this->setCallback_([p, func = static_cast<F&&>(func)](T&& t) mutable {
-    p->setValue(std::move(static_cast<F&&>(func)(std::move(t))).value());
+  this->setCallback_([p = std::move(p), func = static_cast<F&&>(func)](Try<T>&& t) mutable {
+    if (!R::isTry && t.hasException()) {
+      p.setException(std::move(t).exception());
+      return;
+    }
+    // forward the inner future's result once it completes, it need not be
+    // ready yet
+    fulfillWithFuture(p, [&] { return static_cast<F&&>(func)(std::move(t)); });
   });
 
   return f;
@@ -151,6 +341,11 @@ FutureBase<T>::thenImplementation(
 
 
 
+template <class T>
+Future<T> Future<T>::makeEmpty() {
+  return Future<T>(nullptr);
+}
+
 template <class T>
 Future<T>::Future(Future<T>&& other) noexcept
     : FutureBase<T>(std::move(other)) {}
@@ -179,44 +374,393 @@ template <typename F>
 Future<typename valueCallableResult<T, F>::value_type>
 Future<T>::then(F&& func) && {
   auto lambdaFunc = [f = static_cast<F&&>(func)](
-                        T&& t) mutable {
+                        Try<T>&& t) mutable {
+    return static_cast<F&&>(f)(std::move(t).value());
+  };
+  using R = valueCallableResult<T, F>;
+  return this->thenImplementation(
+      std::move(lambdaFunc), R{});
+}
+
+template <class T>
+template <typename F>
+Future<typename valueCallableResult<T, F>::value_type>
+Future<T>::thenValue(F&& func) && {
+  return std::move(*this).then(static_cast<F&&>(func));
+}
+
+template <class T>
+template <typename F>
+Future<typename tryCallableResult<T, F>::value_type>
+Future<T>::thenTry(F&& func) && {
+  auto lambdaFunc = [f = static_cast<F&&>(func)](
+                        Try<T>&& t) mutable {
     return static_cast<F&&>(f)(std::move(t));
   };
-  using R = valueCallableResult<T, decltype(lambdaFunc)>;
+  using R = tryCallableResult<T, F>;
   return this->thenImplementation(
       std::move(lambdaFunc), R{});
 }
 
+template <class T>
+template <class F>
+Future<T> Future<T>::thenError(F&& func) && {
+  using Result = std::invoke_result_t<F, std::exception_ptr>;
+  static_assert(std::is_same<typename isFuture<Result>::Inner, T>::value,
+      "thenError must return T or Future<T>");
+
+  if (this->isReadyInline() && this->hasValue()) {
+    this->throwIfContinued();
+    return std::move(*this);
+  }
+
+  Promise<T> p;
+  auto f = p.getFuture();
+  f.getCore().setExecutor(this->getExecutor());
+  f.getCore().setUpstream(&this->getCore());
+
+  this->setCallback_([p = std::move(p), func = static_cast<F&&>(func)](Try<T>&& t) mutable {
+    if (!t.hasException()) {
+      p.setTry(std::move(t));
+      return;
+    }
+    auto call = [&] { return static_cast<F&&>(func)(std::move(t).exception()); };
+    if constexpr (isFuture<Result>::value) {
+      fulfillWithFuture(p, call);
+    } else {
+      p.setWith(call);
+    }
+  });
+
+  return f;
+}
+
+
+template <class T>
+Future<T> Future<T>::via(Executor* executor) && {
+  if (!executor) {
+    throw FutureNoExecutor();
+  }
+  this->getCore().setExecutor(executor);
+  return std::move(*this);
+}
+
+template <class T>
+template <typename F>
+Future<typename valueCallableResult<T, F>::value_type>
+Future<T>::thenOn(Executor* executor, F&& func) && {
+  return std::move(*this).via(executor).then(static_cast<F&&>(func));
+}
+
 
 template <class T>
 template <class F>
 Future<T> Future<T>::ensure(F&& func) && {
-  return std::move(*this).then(
-      [funcw = static_cast<F&&>(func)](T&& t) mutable {
-        static_cast<F&&>(funcw)();
-        return makeFuture(std::move(t));
-      });
+  if (this->isReadyInline()) {
+    this->throwIfContinued();
+    auto r = makeTryWith(static_cast<F&&>(func));
+    if (r.hasException()) {
+      this->detach();
+      return makeFuture<T>(std::move(r).exception());
+    }
+    return std::move(*this);
+  }
+
+  Promise<T> p;
+  auto f = p.getFuture();
+  f.getCore().setExecutor(this->getExecutor());
+  f.getCore().setUpstream(&this->getCore());
+
+  // the result is moved straight into the downstream core
+  this->setCallback_([p = std::move(p), func = static_cast<F&&>(func)](Try<T>&& t) mutable {
+    auto r = makeTryWith(static_cast<F&&>(func));
+    if (r.hasException()) {
+      p.setException(std::move(r).exception());
+    } else {
+      p.setTry(std::move(t));
+    }
+  });
+
+  return f;
 }
 
 
 template <class T>
 Future<T>& Future<T>::wait() & {
-  detail::waitImpl(*this);
+  if (!this->isReady()) {
+    this->getCore().wait();
+  }
   return *this;
 }
 
 template <class T>
 Future<T>&& Future<T>::wait() && {
-  detail::waitImpl(*this);
+  if (!this->isReady()) {
+    this->getCore().wait();
+  }
   return std::move(*this);
 }
 
+template <class T>
+template <class Rep, class Period>
+bool Future<T>::wait(std::chrono::duration<Rep, Period> d) {
+  auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(d);
+  return this->isReady() || this->getCore().waitUntil(deadline);
+}
+
 template <class T>
 T Future<T>::get() && {
   wait();
   return std::move(std::move(*this).value());
 }
 
+template <class T>
+T& Future<T>::getRef() & {
+  wait();
+  return this->value();
+}
+
+template <class T>
+void Future<T>::getInto(T& out) && {
+  wait();
+  out = std::move(this->value());
+}
+
+template <class T>
+template <class Rep, class Period>
+T Future<T>::get(std::chrono::duration<Rep, Period> d) && {
+  if (!wait(d)) {
+    throw FutureTimeout();
+  }
+  return std::move(std::move(*this).value());
+}
+
+template <class T>
+template <class Rep, class Period>
+Future<T> Future<T>::within(std::chrono::duration<Rep, Period> d, Timekeeper* tk) && {
+  if (this->isReady()) {
+    return std::move(*this);
+  }
+  if (!tk) {
+    tk = &getTimekeeper();
+  }
+
+  // whichever of the result and the timer comes first completes p
+  struct Context {
+    Promise<T> p;
+    std::atomic<bool> done = {false};
+    Timekeeper* tk;
+    uint64_t timer;
+  };
+
+  auto ctx = std::make_shared<Context>();
+  ctx->tk = tk;
+  auto f = ctx->p.getFuture();
+  f.getCore().setExecutor(this->getExecutor());
+  f.getCore().setUpstream(&this->getCore());
+
+  ctx->timer = tk->schedule(
+      std::chrono::duration_cast<Timekeeper::Clock::duration>(d), [ctx] {
+        if (!ctx->done.exchange(true, std::memory_order_relaxed)) {
+          ctx->p.setException(FutureTimeout());
+        }
+      });
+  this->setCallback_([ctx](Try<T>&& t) {
+    if (!ctx->done.exchange(true, std::memory_order_relaxed)) {
+      ctx->tk->cancel(ctx->timer);
+      ctx->p.setTry(std::move(t));
+    }
+  });
+
+  return f;
+}
+
+
+namespace detail {
+
+// Uninitialized storage for one input of a collect, constructed when the
+// input completes with a value.
+template <class T>
+struct CollectSlot {
+  CollectSlot() {}
+  ~CollectSlot() {
+    if (set) {
+      value.~T();
+    }
+  }
+  void construct(T&& t) {
+    new (&value) T(std::move(t));
+    set = true;
+  }
+
+  union {
+    T value;
+  };
+  bool set = false;
+};
+
+// Counts down the inputs of a collect. With FailFast the first exception
+// completes the promise at once, otherwise it does once every input has
+// completed.
+template <bool FailFast, class Result>
+struct CollectCountdown {
+  explicit CollectCountdown(size_t n) : remaining(n) {}
+
+  // Hands a value to store(), the last input to arrive completes the promise
+  // with make() unless one failed. Returns true for that last one, nothing
+  // touches the context after it.
+  template <class T, class Store, class Make>
+  bool arrive(Try<T>&& t, Store&& store, Make&& make) {
+    if (t.hasException()) {
+      if (!failed.exchange(true, std::memory_order_relaxed)) {
+        if (FailFast) {
+          p.setException(std::move(t).exception());
+        } else {
+          exception = std::move(t).exception();
+        }
+      }
+    } else {
+      store(std::move(t).value());
+    }
+    // release the slot written above, acquire all the others on the last
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return false;
+    }
+    if (!failed.load(std::memory_order_relaxed)) {
+      p.setValue(make());
+    } else if (!FailFast) {
+      p.setException(std::move(exception));
+    }
+    return true;
+  }
+
+  Promise<Result> p;
+  std::atomic<size_t> remaining;
+  std::atomic<bool> failed = {false};
+  std::exception_ptr exception; // first exception, written once
+};
+
+// The values of a collect over a range, one slot per input.
+template <bool FailFast, class T>
+struct CollectVector : CollectCountdown<FailFast, std::vector<T>> {
+  explicit CollectVector(size_t n)
+      : CollectCountdown<FailFast, std::vector<T>>(n), slots(new CollectSlot<T>[n]), size(n) {}
+
+  bool setTry(size_t i, Try<T>&& t) {
+    return this->arrive(std::move(t), [&](T&& value) {
+      slots[i].construct(std::move(value));
+    }, [&] {
+      std::vector<T> results;
+      results.reserve(size);
+      for (size_t j = 0; j < size; ++j) {
+        results.emplace_back(std::move(slots[j].value));
+      }
+      return results;
+    });
+  }
+
+  std::unique_ptr<CollectSlot<T>[]> slots;
+  size_t size;
+};
+
+// Shared by the callbacks of a variadic collect, in a single allocation.
+template <bool FailFast, class... Ts>
+struct CollectVariadicContext : CollectCountdown<FailFast, std::tuple<Ts...>> {
+  CollectVariadicContext() : CollectCountdown<FailFast, std::tuple<Ts...>>(sizeof...(Ts)) {}
+
+  template <size_t I, class T>
+  void setTry(index_constant<I>, Try<T>&& t) {
+    auto last = this->arrive(std::move(t), [&](T&& value) {
+      std::get<I>(slots).construct(std::move(value));
+    }, [&] {
+      return make(std::index_sequence_for<Ts...>());
+    });
+    if (last) {
+      delete this;
+    }
+  }
+
+  template <size_t... I>
+  std::tuple<Ts...> make(std::index_sequence<I...>) {
+    return std::tuple<Ts...>(std::move(std::get<I>(slots).value)...);
+  }
+
+  std::tuple<CollectSlot<Ts>...> slots;
+};
+
+// Drives window() and mapBounded(): starts calls until one of them returns a
+// future that is still pending, whose completion starts the next ones. Ready
+// results don't recurse, so a long run of them does not grow the stack.
+// ctx->next(i, r) claims input i and calls it into r, it returns false once
+// there is nothing left to start. Results go to ctx->setTry(i, t).
+template <class Context>
+void spawnBounded(const std::shared_ptr<Context>& ctx) {
+  using Result = typename Context::Result;
+  using R = LiftUnit_t<typename isFuture<Result>::Inner>;
+  for (;;) {
+    size_t i;
+    Try<LiftUnit_t<Result>> r;
+    if (!ctx->next(i, r)) {
+      return;
+    }
+    if constexpr (isFuture<Result>::value) {
+      if (r.hasException()) {
+        ctx->setTry(i, Try<R>(std::move(r).exception()));
+        continue;
+      }
+      auto& f = r.value();
+      if (f.isReady()) {
+        ctx->setTry(i, std::move(f).result());
+        continue;
+      }
+      f.setCallback_([ctx, i](Try<R>&& t) {
+        ctx->setTry(i, std::move(t));
+        spawnBounded(ctx);
+      });
+      return;
+    } else {
+      ctx->setTry(i, std::move(r));
+    }
+  }
+}
+
+template <class Context, size_t I, class T>
+void collectVariadicInput(Context* ctx, index_constant<I>, Future<T>& f) {
+  f.setCallback_([ctx](Try<T>&& t) {
+    ctx->setTry(index_constant<I>(), std::move(t));
+  });
+}
+
+template <bool FailFast, class... Ts, size_t... I>
+Future<std::tuple<Ts...>> collectVariadic(std::index_sequence<I...>, Future<Ts>&... fs) {
+  if constexpr (sizeof...(Ts) == 0) {
+    return makeFuture(std::tuple<>());
+  } else {
+    auto* ctx = new CollectVariadicContext<FailFast, Ts...>();
+    auto f = ctx->p.getFuture();
+    (collectVariadicInput(ctx, index_constant<I>(), fs), ...);
+    return f;
+  }
+}
+
+}
+
+
+// Joins futures of different types, completing once all of them have
+// completed with a tuple of their values, or with the first exception.
+template <class... Ts>
+Future<std::tuple<Ts...>> collectAll(Future<Ts>&&... fs) {
+  return detail::collectVariadic<false, Ts...>(std::index_sequence_for<Ts...>(), fs...);
+}
+
+// Like the variadic collectAll(), but completes with the first exception as
+// soon as an input fails.
+template <class... Ts>
+Future<std::tuple<Ts...>> collect(Future<Ts>&&... fs) {
+  return detail::collectVariadic<true, Ts...>(std::index_sequence_for<Ts...>(), fs...);
+}
+
 
 template <class T>
 Future<std::vector<T>> collectAll(std::vector<Future<T>>&& futures){
@@ -224,6 +768,11 @@ Future<std::vector<T>> collectAll(std::vector<Future<T>>&& futures){
 }
 
 
+// Completes once every input has completed, with all the values in input
+// order or with the first exception. The context is owned by the inputs'
+// callbacks and the one that completes last fulfills the promise and frees
+// it. Values are constructed in place as they arrive, T need not be default
+// constructible nor copyable.
 template <class InputIterator>
 Future<std::vector<
     typename std::iterator_traits<InputIterator>::value_type::value_type>>
@@ -231,68 +780,82 @@ collectAll(InputIterator first, InputIterator last) {
   using F = typename std::iterator_traits<InputIterator>::value_type;
   using T = typename F::value_type;
 
-  struct Context {
-    explicit Context(size_t n) : results(n) {}
-    ~Context() {
-      p.setValue(std::move(std::move(results)));
-    }
-    Promise<std::vector<T>> p;
-    std::vector<T> results;
-  };
-
-
-  auto ctx = std::make_shared<Context>(size_t(std::distance(first, last)));
+  auto n = size_t(std::distance(first, last));
+  if (n == 0) {
+    return makeFuture(std::vector<T>());
+  }
 
+  auto* ctx = new detail::CollectVector<false, T>(n);
+  auto f = ctx->p.getFuture();
   for (size_t i = 0; first != last; ++first, ++i) {
-    first->setCallback_(
-        [i, ctx](T&& t) {
-          ctx->results[i] = std::move(t);
-        });
+    first->setCallback_([i, ctx](Try<T>&& t) {
+      if (ctx->setTry(i, std::move(t))) {
+        delete ctx;
+      }
+    });
   }
 
-  return ctx->p.getFuture();
+  return f;
 }
 
 template <class T>
-Future<std::vector<std::pair<size_t, T>>> collectN(std::vector<Future<T>>&& futures, size_t n){
-  return collectN(futures.begin(), futures.end(), n);
+Future<std::vector<std::pair<size_t, T>>> collectN(
+    std::vector<Future<T>>&& futures, size_t n, bool cancelLosers = false) {
+  return collectN(futures.begin(), futures.end(), n, cancelLosers);
 }
 
 
 // collectN (iterator)
 
+// Completes with the first n inputs to complete, ordered by input index, or
+// with the exception of one of them. Storage is kept for those n results
+// only and released together with the promise once it is fulfilled. Values
+// of inputs completing later are destroyed right away. Only with
+// cancelLosers are the inputs still running interrupted, the inputs are then
+// moved out of the range to be reachable.
 template <class InputIterator>
 Future<std::vector<std::pair<
     size_t,
     typename std::iterator_traits<InputIterator>::value_type::value_type>>>
-collectN(InputIterator first, InputIterator last, size_t n) {
+collectN(InputIterator first, InputIterator last, size_t n, bool cancelLosers = false) {
   using F = typename std::iterator_traits<InputIterator>::value_type;
   using T = typename F::value_type;
   using Result = std::vector<std::pair<size_t, T>>;
 
   struct Context {
-    explicit Context(size_t numFutures, size_t min_)
-        : v(numFutures), min(min_) {}
+    explicit Context(size_t min_) : v(min_), min(min_) {}
 
-    std::vector<std::optional<T>> v;
+    // in completion order, only the first min inputs
+    std::vector<std::pair<size_t, Try<T>>> v;
     size_t min;
     std::atomic<size_t> completed = {0}; // # input futures completed
     std::atomic<size_t> stored = {0}; // # output values stored
     Promise<Result> p;
+    // not resized after the callbacks are set
+    std::vector<F> inputs;
   };
 
   assert(n > 0);
   assert(std::distance(first, last) >= 0);
 
-  auto ctx = std::make_shared<Context>(size_t(std::distance(first, last)), n);
-  for (size_t i = 0; first != last; ++first, ++i) {
-    first->setCallback_([i, ctx](T&& t) {
+  auto ctx = std::make_shared<Context>(n);
+  if (cancelLosers) {
+    for (; first != last; ++first) {
+      ctx->inputs.push_back(std::move(*first));
+    }
+  }
+  auto f = ctx->p.getFuture();
+
+  auto callback = [ctx, cancelLosers](size_t i) {
+    return [i, ctx, cancelLosers](Try<T>&& t) {
       // relaxed because this guards control but does not guard data
       auto const c = 1 + ctx->completed.fetch_add(1, std::memory_order_relaxed);
       if (c > ctx->min) {
+        // nobody will read it, don't keep it alive in the input's core
+        Try<T> dropped(std::move(t));
         return;
       }
-      ctx->v[i] = std::move(t);
+      ctx->v[c - 1] = std::make_pair(i, std::move(t));
 
       // release because the stored values in all threads must be visible below
       // acquire because no stored value is permitted to be fetched early
@@ -300,50 +863,354 @@ collectN(InputIterator first, InputIterator last, size_t n) {
       if (s < ctx->min) {
         return;
       }
+      // the results and the promise are released here, not when the slowest
+      // input completes
+      auto v = std::move(ctx->v);
+      auto p = std::move(ctx->p);
+      if (cancelLosers) {
+        for (auto& input : ctx->inputs) {
+          input.cancel();
+        }
+      }
+      std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+      });
       Result result;
-      result.reserve(ctx->completed.load());
-      for (size_t j = 0; j < ctx->v.size(); ++j) {
-        auto& entry = ctx->v[j];
-        if (entry.has_value()) {
-          result.emplace_back(j, std::move(entry).value());
+      result.reserve(v.size());
+      for (auto& entry : v) {
+        if (entry.second.hasException()) {
+          p.setException(std::move(entry.second).exception());
+          return;
         }
+        result.emplace_back(entry.first, std::move(entry.second).value());
       }
-      ctx->p.setValue(std::move(result));
-    });
+      p.setValue(std::move(result));
+    };
+  };
+
+  if (cancelLosers) {
+    for (size_t i = 0; i < ctx->inputs.size(); ++i) {
+      ctx->inputs[i].setCallback_(callback(i));
+    }
+  } else {
+    for (size_t i = 0; first != last; ++first, ++i) {
+      first->setCallback_(callback(i));
+    }
   }
 
-  return ctx->p.getFuture();
+  return f;
 }
 
 
 template <class T>
-Future<std::pair<size_t, T>> collectAny(std::vector<Future<T>>&& futures){
-  return collectAny(futures.begin(), futures.end());
+Future<std::pair<size_t, T>> collectAny(std::vector<Future<T>>&& futures, bool cancelLosers = true){
+  return collectAny(futures.begin(), futures.end(), cancelLosers);
 }
 
 
 // collectAny (iterator)
 
+// Completes with the index and result of the first input to complete. The
+// promise is released as soon as it is fulfilled and the values of the
+// losers are destroyed as they arrive. With cancelLosers the losers are
+// interrupted once there is a winner.
 template <class InputIterator>
 Future<std::pair<
     size_t,
     typename std::iterator_traits<InputIterator>::value_type::value_type>>
-collectAny(InputIterator first, InputIterator last) {
+collectAny(InputIterator first, InputIterator last, bool cancelLosers = true) {
   using F = typename std::iterator_traits<InputIterator>::value_type;
   using T = typename F::value_type;
 
   struct Context {
     Promise<std::pair<size_t, T>> p;
     std::atomic<bool> done{false};
+    // not resized after the callbacks are set, raising on an input is
+    // thread safe
+    std::vector<F> inputs;
   };
 
   auto ctx = std::make_shared<Context>();
-  for (size_t i = 0; first != last; ++first, ++i) {
-    first->setCallback_([i, ctx](T&& t) {
-      if (!ctx->done.exchange(true, std::memory_order_relaxed)) {
-        ctx->p.setValue(std::make_pair(i, std::move(t)));
+  for (; first != last; ++first) {
+    ctx->inputs.push_back(std::move(*first));
+  }
+  // interrupting the result interrupts every input still running
+  ctx->p.setInterruptHandler([weak = std::weak_ptr<Context>(ctx)](const std::exception_ptr& e) {
+    if (auto ctx = weak.lock()) {
+      if (!ctx->done.load(std::memory_order_relaxed)) {
+        for (auto& input : ctx->inputs) {
+          input.raise(e);
+        }
+      }
+    }
+  });
+  auto f = ctx->p.getFuture();
+  for (size_t i = 0; i < ctx->inputs.size(); ++i) {
+    ctx->inputs[i].setCallback_([i, ctx, cancelLosers](Try<T>&& t) {
+      if (ctx->done.exchange(true, std::memory_order_relaxed)) {
+        // a loser, don't keep its value alive in the input's core
+        Try<T> dropped(std::move(t));
+        return;
+      }
+      auto p = std::move(ctx->p);
+      if (t.hasException()) {
+        p.setException(std::move(t).exception());
+      } else {
+        p.setValue(std::make_pair(i, std::move(t).value()));
+      }
+      if (cancelLosers) {
+        // the losers' results will be dropped, let their producers stop
+        for (size_t j = 0; j < ctx->inputs.size(); ++j) {
+          if (j != i) {
+            ctx->inputs[j].cancel();
+          }
+        }
       }
     });
   }
-  return ctx->p.getFuture();
+  return f;
+}
+
+
+namespace futures {
+
+template <class Rep, class Period>
+Future<Unit> sleep(std::chrono::duration<Rep, Period> d, Timekeeper* tk) {
+  if (!tk) {
+    tk = &getTimekeeper();
+  }
+  Promise<Unit> p;
+  auto f = p.getFuture();
+  tk->schedule(
+      std::chrono::duration_cast<Timekeeper::Clock::duration>(d),
+      [p = std::move(p)]() mutable { p.setValue(); });
+  return f;
+}
+
+
+
+template <class InputIterator, class T, class F>
+Future<T> reduce(InputIterator first, InputIterator last, T init, F&& fn) {
+  using I = typename std::iterator_traits<InputIterator>::value_type;
+
+  // the inputs' cores hold the values that arrive out of order, whoever
+  // completes the next input in line folds as far as it can
+  struct Context {
+    Context(T&& init, F&& fn) : acc(std::move(init)), fn(static_cast<F&&>(fn)) {}
+
+    void fold() {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!started) {
+        return;
+      }
+      while (next < inputs.size() && inputs[next].isReady()) {
+        auto t = std::move(inputs[next]).result();
+        // released here as the cores still pending may not be
+        inputs[next++] = Future<typename I::value_type>::makeEmpty();
+        if (exception) {
+          continue;
+        }
+        if (t.hasException()) {
+          exception = std::move(t).exception();
+          continue;
+        }
+        try {
+          acc = fn(std::move(acc), std::move(t).value());
+        } catch (...) {
+          exception = std::current_exception();
+        }
+      }
+      if (next < inputs.size() || !p) {
+        return;
+      }
+      auto done = std::move(*p);
+      p.reset();
+      lock.unlock();
+      if (exception) {
+        done.setException(std::move(exception));
+      } else {
+        done.setValue(std::move(acc));
+      }
+    }
+
+    std::mutex mutex;
+    T acc;
+    std::decay_t<F> fn;
+    std::exception_ptr exception;
+    std::optional<Promise<T>> p = Promise<T>();
+    std::vector<I> inputs;
+    size_t next = 0;
+    // inputs are left alone until all the callbacks are set
+    bool started = false;
+  };
+
+  if (first == last) {
+    return makeFuture(std::move(init));
+  }
+  auto ctx = std::make_shared<Context>(std::move(init), static_cast<F&&>(fn));
+  for (; first != last; ++first) {
+    ctx->inputs.push_back(std::move(*first));
+  }
+  auto f = ctx->p->getFuture();
+  for (auto& input : ctx->inputs) {
+    input.setCallback_([ctx](auto&&) { ctx->fold(); });
+  }
+  {
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    ctx->started = true;
+  }
+  ctx->fold();
+  return f;
+}
+
+
+template <class InputIterator, class T, class F>
+Future<T> unorderedReduce(InputIterator first, InputIterator last, T init, F&& fn) {
+  using V = typename std::iterator_traits<InputIterator>::value_type::value_type;
+
+  struct Context {
+    Context(T&& init, F&& fn, size_t n)
+        : acc(std::move(init)), fn(static_cast<F&&>(fn)), remaining(n) {}
+
+    std::mutex mutex;
+    T acc;
+    std::decay_t<F> fn;
+    std::exception_ptr exception;
+    size_t remaining;
+    Promise<T> p;
+  };
+
+  auto n = size_t(std::distance(first, last));
+  if (n == 0) {
+    return makeFuture(std::move(init));
+  }
+  auto ctx = std::make_shared<Context>(std::move(init), static_cast<F&&>(fn), n);
+  auto f = ctx->p.getFuture();
+  for (; first != last; ++first) {
+    first->setCallback_([ctx](Try<V>&& t) {
+      std::unique_lock<std::mutex> lock(ctx->mutex);
+      if (!ctx->exception) {
+        if (t.hasException()) {
+          ctx->exception = std::move(t).exception();
+        } else {
+          try {
+            ctx->acc = ctx->fn(std::move(ctx->acc), std::move(t).value());
+          } catch (...) {
+            ctx->exception = std::current_exception();
+          }
+        }
+      }
+      if (--ctx->remaining != 0) {
+        return;
+      }
+      lock.unlock();
+      if (ctx->exception) {
+        ctx->p.setException(std::move(ctx->exception));
+      } else {
+        ctx->p.setValue(std::move(ctx->acc));
+      }
+    });
+  }
+  return f;
+}
+
+
+template <class T, class F>
+std::vector<Future<LiftUnit_t<typename isFuture<std::invoke_result_t<F, T&&>>::Inner>>>
+window(std::vector<T> input, F func, size_t n) {
+  using Result = std::invoke_result_t<F, T&&>;
+  using R = LiftUnit_t<typename isFuture<Result>::Inner>;
+
+  struct Context {
+    using Result = std::invoke_result_t<F, T&&>;
+
+    Context(std::vector<T>&& input, F&& func)
+        : input(std::move(input)), func(std::move(func)), promises(this->input.size()) {}
+
+    bool next(size_t& i, Try<LiftUnit_t<Result>>& r) {
+      i = cursor.fetch_add(1, std::memory_order_relaxed);
+      if (i >= input.size()) {
+        return false;
+      }
+      r = makeTryWith([&] { return func(std::move(input[i])); });
+      return true;
+    }
+
+    void setTry(size_t i, Try<R>&& t) { promises[i].setTry(std::move(t)); }
+
+    std::vector<T> input;
+    F func;
+    std::vector<Promise<R>> promises;
+    std::atomic<size_t> cursor = {0};
+  };
+
+  assert(n > 0);
+  auto ctx = std::make_shared<Context>(std::move(input), std::move(func));
+  std::vector<Future<R>> futures;
+  futures.reserve(ctx->promises.size());
+  for (auto& p : ctx->promises) {
+    futures.push_back(p.getFuture());
+  }
+  for (size_t i = 0; i < n && i < ctx->input.size(); ++i) {
+    detail::spawnBounded(ctx);
+  }
+  return futures;
+}
+
+
+
+template <class Iterable, class F>
+Future<std::vector<LiftUnit_t<typename isFuture<
+    std::invoke_result_t<F, decltype(*std::begin(std::declval<Iterable&>()))>>::Inner>>>
+mapBounded(Iterable items, size_t maxInFlight, F fn) {
+  using Iterator = decltype(std::begin(items));
+  using Result = std::invoke_result_t<F, decltype(*std::declval<Iterator&>())>;
+  using R = LiftUnit_t<typename isFuture<Result>::Inner>;
+
+  struct Context {
+    using Result = std::invoke_result_t<F, decltype(*std::declval<Iterator&>())>;
+
+    Context(Iterable&& items_, F&& fn_)
+        : items(std::move(items_)), fn(std::move(fn_)), cursor(std::begin(items)),
+          size(size_t(std::distance(cursor, std::end(items)))), collect(size) {}
+
+    // stops starting elements once one has failed
+    bool next(size_t& i, Try<LiftUnit_t<Result>>& r) {
+      if (collect.failed.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      if (cursor == std::end(items)) {
+        return false;
+      }
+      auto it = cursor++;
+      i = index++;
+      lock.unlock();
+      r = makeTryWith([&] { return fn(*it); });
+      return true;
+    }
+
+    void setTry(size_t i, Try<R>&& t) { collect.setTry(i, std::move(t)); }
+
+    Iterable items;
+    F fn;
+    std::mutex mutex;
+    Iterator cursor; // guarded by mutex
+    size_t index = 0; // guarded by mutex
+    size_t size;
+    detail::CollectVector<true, R> collect;
+  };
+
+  assert(maxInFlight > 0);
+  auto ctx = std::make_shared<Context>(std::move(items), std::move(fn));
+  if (ctx->size == 0) {
+    return makeFuture(std::vector<R>());
+  }
+  auto f = ctx->collect.p.getFuture();
+  for (size_t i = 0; i < maxInFlight && i < ctx->size; ++i) {
+    detail::spawnBounded(ctx);
+  }
+  return f;
+}
+
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <type_traits>
+#include "unit.h"
 
 
 template <std::size_t I>
@@ -12,6 +13,9 @@ class Promise;
 template <class>
 class Future;
 
+template <class>
+class Try;
+
 template <typename T>
 struct isFuture : std::false_type {
   using Inner = T;
@@ -45,11 +49,24 @@ struct argResult {
   using ArgsSize = index_constant<sizeof...(Args)>;
 };
 
+// Continuations taking a Try<T>&& see exceptions, continuations taking T&& are
+// skipped and the exception is forwarded. Continuations returning void produce
+// a Future<Unit>.
+template <typename T, typename F>
+struct tryCallableResult {
+  typedef argResult<F, Try<T>&&> Arg;
+  typedef isFuture<typename Arg::Result> ReturnsFuture;
+  typedef LiftUnit_t<typename ReturnsFuture::Inner> value_type;
+  typedef Future<value_type> Return;
+  static constexpr bool isTry = true;
+};
+
 template <typename T, typename F>
 struct valueCallableResult {
   typedef argResult<F, T&&> Arg;
   typedef isFuture<typename Arg::Result> ReturnsFuture;
-  typedef typename ReturnsFuture::Inner value_type;
+  typedef LiftUnit_t<typename ReturnsFuture::Inner> value_type;
   typedef typename Arg::ArgList::FirstArg FirstArg;
   typedef Future<value_type> Return;
+  static constexpr bool isTry = false;
 };
@@ -0,0 +1,41 @@
+#pragma once
+#include <memory>
+#include "shared-promise.h"
+
+
+// Splits one Future into any number of futures completing with copies of its
+// result, so several consumers can share a single computation. The futures
+// handed out continue on the executor of the source future, if it has one.
+template <class T>
+class FutureSplitter {
+public:
+  FutureSplitter() = default;
+
+  explicit FutureSplitter(Future<T>&& future)
+      : promise_(std::make_shared<SharedPromise<T>>()),
+        executor_(future.getExecutor()) {
+    future.setCallback_([promise = promise_](Try<T>&& t) {
+      promise->setTry(std::move(t));
+    });
+  }
+
+  FutureSplitter(FutureSplitter&&) noexcept = default;
+  FutureSplitter& operator=(FutureSplitter&&) noexcept = default;
+
+  // Throws FutureInvalid on a default constructed or moved from splitter.
+  Future<T> getFuture() {
+    if (!promise_) {
+      throw FutureInvalid();
+    }
+    auto f = promise_->getFuture();
+    if (executor_) {
+      f.getCore().setExecutor(executor_);
+    }
+    return f;
+  }
+
+private:
+  // shared with the callback on the source future, which may outlive us
+  std::shared_ptr<SharedPromise<T>> promise_;
+  Executor* executor_ = nullptr;
+};
@@ -1,6 +1,14 @@
 #pragma once
 #include<cassert>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
 #include "future-pre.h"
+#include "executor.h"
+#include "timekeeper.h"
+#include "try.h"
+#include "unit.h"
 
 
 class FutureException : public std::logic_error {
@@ -53,8 +61,44 @@ class FutureNoExecutor : public FutureException {
 template <class T>
 class Future;
 
+// Bytes a ready Future may use to hold its result itself instead of in a
+// Core, see FutureBase.
+#ifndef FUTURE_INLINE_RESULT_SIZE
+#define FUTURE_INLINE_RESULT_SIZE 16
+#endif
+
+constexpr std::size_t kFutureInlineResultSize = FUTURE_INLINE_RESULT_SIZE;
+
+namespace detail {
+
+template <class T, bool = (sizeof(Try<T>) <= kFutureInlineResultSize &&
+                           std::is_nothrow_move_constructible<Try<T>>::value)>
+struct FutureInlineResult {
+  static constexpr bool enabled = true;
+  FutureInlineResult() {}
+  ~FutureInlineResult() {}
+
+  union {
+    Try<T> ready_;
+  };
+  // Set once a callback ran on ready_. The future stays inline and readable
+  // like a continued core, core_ is not written again so raise() and
+  // isReady() stay safe to call from other threads.
+  bool continued_ = false;
+};
+
+template <class T>
+struct FutureInlineResult<T, false> {
+  static constexpr bool enabled = false;
+};
+
+}
+
+/// A Future created ready, e.g. by makeFuture() or by then() on a ready
+/// Future, holds a small result itself and allocates no Core. One is created
+/// from the result only once something needs it, such as via().
 template<typename T>
-class FutureBase {
+class FutureBase : private detail::FutureInlineResult<T> {
 public:
   using value_type = T;
 
@@ -72,10 +116,29 @@ public:
   T&& value() &&;
   T const&& value() const&&;
 
+  /// Returns the Try of the completed future, throws FutureNotReady if it has
+  /// not completed yet.
+  Try<T>& result() &;
+  Try<T> const& result() const&;
+  Try<T>&& result() &&;
+
   bool isReady() const;
   bool hasValue() const;
+  bool hasException() const;
   std::optional<T> poll();
 
+  Executor* getExecutor() const;
+
+  /// Raises an interrupt on this Future. It reaches the interrupt handler of
+  /// the producing Promise and travels upstream through the chain of
+  /// continuations this Future was built from. It is a request only, the
+  /// producer decides whether to stop and with which result. Interrupts
+  /// after the first one, or after the Future completed, are ignored.
+  void raise(std::exception_ptr e);
+
+  /// Raises a FutureCancellation interrupt.
+  void cancel() { raise(std::make_exception_ptr(FutureCancellation())); }
+
   template <class F>
   void setCallback_(F&& func);
 
@@ -88,8 +151,10 @@ protected:
   template <class>
   friend class Future;
 
-  Core<T>& getCore() { return getCoreImpl(*this); }
-  Core<T> const& getCore() const { return getCoreImpl(*this); }
+  using Inline = detail::FutureInlineResult<T>;
+
+  // Moves an inline result into a new core first.
+  Core<T>& getCore();
 
   template <typename Self>
   static decltype(auto) getCoreImpl(Self& self) {
@@ -99,21 +164,38 @@ protected:
     return *self.core_;
   }
 
-  T& getCoreValueChecked() { return getCoreValueChecked(*this); }
-  T const& getCoreValueChecked() const { return getCoreValueChecked(*this); }
+  Try<T>& getCoreTryChecked() { return getCoreTryChecked(*this); }
+  Try<T> const& getCoreTryChecked() const { return getCoreTryChecked(*this); }
 
   template <typename Self>
-  static decltype(auto) getCoreValueChecked(Self& self) {
-    auto& core = self.getCore();
+  static auto getCoreTryChecked(Self& self)
+      -> std::conditional_t<std::is_const<Self>::value, Try<T> const&, Try<T>&> {
+    if constexpr (Inline::enabled) {
+      if (self.isInline()) {
+        return self.ready_;
+      }
+    }
+    auto& core = getCoreImpl(self);
     if (!core.hasResult()) {
       throw FutureNotReady();
     }
     return core.get();
   }
 
-  std::shared_ptr<Core<T>> core_;
+  // core_ while the result is held inline
+  static Core<T>* inlineTag() noexcept {
+    return reinterpret_cast<Core<T>*>(uintptr_t(1));
+  }
+  bool isInline() const noexcept { return Inline::enabled && core_ == inlineTag(); }
+
+  // Whether a callback set now would run right away on this thread: the
+  // result is there and there is no executor to hand it to.
+  bool isReadyInline() const;
 
-  explicit FutureBase(std::shared_ptr<Core<T>> obj) : core_(obj) {}
+  Core<T>* core_;
+
+  explicit FutureBase(Core<T>* obj) : core_(obj) {}
+  explicit FutureBase(Try<T>&& t);
 
 
 
@@ -121,9 +203,20 @@ protected:
   void throwIfContinued() const;
 
   void assign(FutureBase<T>&& other) noexcept;
+  void detach() noexcept;
+  // Takes over other's core or inline result, other must be empty.
+  void moveFrom(FutureBase<T>& other) noexcept;
+
+  // Completes p with the result of the future returned by func once that
+  // completes, or with the exception func throws. Interrupts raised on p's
+  // future are forwarded to the returned future.
+  template <class B, class F>
+  static void fulfillWithFuture(Promise<B>& p, F&& func);
 
   // Variant: returns a value
   // e.g. f.thenTry([](Try<T> t){ return t.value(); });
+  // func is always called with a Try<T>&&. If R::isTry is false an exception
+  // is forwarded without calling func.
   template <typename F, typename R>
   typename std::enable_if<!R::ReturnsFuture::value, typename R::Return>::type
   thenImplementation(F&& func, R);
@@ -151,8 +244,14 @@ class Future : private FutureBase<T> {
   Future(Future<T>&&) noexcept;
 
 
+  using Base::cancel;
+  using Base::getExecutor;
+  using Base::hasException;
+  using Base::hasValue;
   using Base::isReady;
   using Base::poll;
+  using Base::raise;
+  using Base::result;
   using Base::setCallback_;
   using Base::value;
 
@@ -187,6 +286,22 @@ class Future : private FutureBase<T> {
       enable_if<isFuture<F>::value, Future<typename isFuture<T>::Inner>>::type
       unwrap() &&;
 
+  /// Returns a Future whose continuations run on `executor` instead of inline
+  /// on the thread that completes it. Futures returned by then() on the
+  /// result inherit the executor.
+  ///
+  /// Preconditions:
+  ///
+  /// - `valid() == true` (else throws FutureInvalid)
+  /// - `executor != nullptr` (else throws FutureNoExecutor)
+  ///
+  /// Postconditions:
+  ///
+  /// - Calling code should act as if `valid() == false`,
+  ///   i.e., as if `*this` was moved into RESULT.
+  /// - `RESULT.valid() == true`
+  Future<T> via(Executor* executor) &&;
+
 
 
 
@@ -221,6 +336,41 @@ class Future : private FutureBase<T> {
   Future<typename valueCallableResult<T, F>::value_type>
   then(F&& func) &&;
 
+  /// Alias of then(), func is called with `T&&` and skipped if this Future
+  /// completed with an exception, which is forwarded to the RESULT.
+  template <typename F>
+  Future<typename valueCallableResult<T, F>::value_type>
+  thenValue(F&& func) &&;
+
+  /// When this Future has completed, execute func which is called with a
+  /// `Try<T>&&` holding either the value or the exception.
+  ///
+  ///   Future<int> f2 = f1.thenTry([](Try<int>&& t) {
+  ///     return t.hasValue() ? t.value() : -1;
+  ///   });
+  ///
+  /// Func shall return either another Future or a value. An exception thrown
+  /// by func completes the RESULT with that exception.
+  template <typename F>
+  Future<typename tryCallableResult<T, F>::value_type>
+  thenTry(F&& func) &&;
+
+  /// Recovers from an exception. func is called with the `std::exception_ptr`
+  /// if this Future completed with an exception and shall return either a
+  /// `T` or a `Future<T>`. A value is passed through untouched.
+  ///
+  ///   Future<int> f2 = f1.thenError([](std::exception_ptr e) {
+  ///     return -1;
+  ///   });
+  template <class F>
+  Future<T> thenError(F&& func) &&;
+
+  /// Like then(), but func runs on `executor`. Equivalent to
+  /// `std::move(*this).via(executor).then(func)`.
+  template <typename F>
+  Future<typename valueCallableResult<T, F>::value_type>
+  thenOn(Executor* executor, F&& func) &&;
+
 
 
 
@@ -245,12 +395,49 @@ class Future : private FutureBase<T> {
   Future<T> ensure(F&& func) &&;
 
 
+  /// Returns a Future that completes with the result of this one, or with a
+  /// FutureTimeout exception if that does not arrive within `d`. The timer
+  /// runs on `tk`, or on the default timekeeper if it is null.
+  ///
+  /// Preconditions:
+  ///
+  /// - `valid() == true` (else throws FutureInvalid)
+  ///
+  /// Postconditions:
+  ///
+  /// - Calling code should act as if `valid() == false`,
+  ///   i.e., as if `*this` was moved into RESULT.
+  /// - `RESULT.valid() == true`
+  template <class Rep, class Period>
+  Future<T> within(std::chrono::duration<Rep, Period> d, Timekeeper* tk = nullptr) &&;
+
+
+  /// Blocks until the Future is complete and returns the value, rethrowing
+  /// the exception if it completed with one.
   T get() &&;
 
+  /// Blocks until the Future is complete and returns a reference to the value
+  /// in its storage, rethrowing the exception if it completed with one. The
+  /// reference is valid as long as this Future.
+  T& getRef() &;
+
+  /// Blocks until the Future is complete and move assigns the value into
+  /// `out`, rethrowing the exception if it completed with one.
+  void getInto(T& out) &&;
+
+  /// Like get(), but throws FutureTimeout if the Future does not complete
+  /// within `d`.
+  template <class Rep, class Period>
+  T get(std::chrono::duration<Rep, Period> d) &&;
+
   Future<T>& wait() &;
 
   Future<T>&& wait() &&;
 
+  /// Blocks for at most `d` and returns whether the Future is ready.
+  template <class Rep, class Period>
+  bool wait(std::chrono::duration<Rep, Period> d);
+
  protected:
   friend class Promise<T>;
   template <class>
@@ -259,20 +446,31 @@ class Future : private FutureBase<T> {
   template <class T2>
   friend Future<T2> makeFuture(T2&&);
 
+  template <class T2>
+  friend Future<T2> makeFuture(Try<T2>&&);
+
   template <class>
   friend class Future;
 
   template <class>
   friend class FutureSplitter;
 
+  template <class>
+  friend class SharedPromise;
+
   using Base::throwIfContinued;
   using Base::throwIfInvalid;
 
-  explicit Future(std::shared_ptr<Core<T>> obj) : Base(obj) {}
+  explicit Future(Core<T>* obj) : Base(obj) {}
+  explicit Future(Try<T>&& t) : Base(std::move(t)) {}
 
 
 };
 
+/// Returns a Future<Unit> that is already complete, e.g. to start a chain of
+/// continuations run only for their side effects.
+inline Future<Unit> makeFuture();
+
 template <class T>
 std::pair<Promise<T>, Future<T>> makePromiseContract() {
   auto p = Promise<T>();
@@ -280,4 +478,44 @@ std::pair<Promise<T>, Future<T>> makePromiseContract() {
   return std::make_pair(std::move(p), std::move(f));
 }
 
+namespace futures {
+
+/// Returns a Future that completes after `d` has elapsed, using `tk` or the
+/// default timekeeper if it is null. No thread is blocked while sleeping.
+template <class Rep, class Period>
+Future<Unit> sleep(std::chrono::duration<Rep, Period> d, Timekeeper* tk = nullptr);
+
+/// Folds the values of the futures in [first, last) into `init` in input
+/// order, calling `fn(T&& acc, V&& value)` which returns the next
+/// accumulator. Values are folded as soon as they and all the ones before
+/// them have arrived, and each input is released once folded, so nothing is
+/// buffered beyond the input cores that are still pending. Completes with
+/// the first exception of an input or of fn.
+template <class InputIterator, class T, class F>
+Future<T> reduce(InputIterator first, InputIterator last, T init, F&& fn);
+
+/// Like reduce(), but values are folded in the order they arrive.
+template <class InputIterator, class T, class F>
+Future<T> unorderedReduce(InputIterator first, InputIterator last, T init, F&& fn);
+
+/// Calls `func(T&&)` on every element of input, which returns a value or a
+/// Future, with at most n of the returned futures pending at a time. The
+/// next call is made when one of them completes. Returns one Future per
+/// element, in input order.
+template <class T, class F>
+std::vector<Future<LiftUnit_t<typename isFuture<std::invoke_result_t<F, T&&>>::Inner>>>
+window(std::vector<T> input, F func, size_t n);
+
+/// Calls `fn` on every element of `items`, which returns a value or a
+/// Future, and completes with all the results in order, or with the first
+/// exception. At most `maxInFlight` of the returned futures are pending at
+/// a time, the next element is started when one of them completes. After a
+/// failure no new element is started.
+template <class Iterable, class F>
+Future<std::vector<LiftUnit_t<typename isFuture<
+    std::invoke_result_t<F, decltype(*std::begin(std::declval<Iterable&>()))>>::Inner>>>
+mapBounded(Iterable items, size_t maxInFlight, F fn);
+
+}
+
 #include "future-inl.h"
@@ -2,13 +2,563 @@
 #include <thread>
 #include <chrono>
 #include <numeric>
+#include <atomic>
 #include "core.h"
 #include "promise.h"
 #include "future.h"
+#include "future-splitter.h"
+#include "work-stealing-executor.h"
+#include "counting-new.h"
 
 
 int main(){
   std::cout<<"hello world"<<std::endl;
+
+  {
+  // each then() hop costs exactly one allocation: the downstream Core
+  auto [p, f] = makePromiseContract<int>();
+  auto before = allocations.load();
+  auto f1 = std::move(f).then([](int i){
+    return i + 1;
+  }).then([](int i){
+    return i * 2;
+  }).then([](int i){
+    return i - 1;
+  });
+  assert(allocations.load() - before == 3);
+  p.setValue(1);
+  assert(allocations.load() - before == 3);
+  assert(std::move(f1).get() == 3);
+  std::cout<<"then allocations per hop: "<<(allocations.load() - before) / 3<<std::endl;
+
+  // so does a hop returning a ready future
+  auto [p2, f2] = makePromiseContract<int>();
+  before = allocations.load();
+  auto f3 = std::move(f2).then([](int i){
+    return makeFuture(i * 2);
+  });
+  p2.setValue(2);
+  assert(allocations.load() - before == 1);
+  assert(std::move(f3).get() == 4);
+  }
+
+  {
+  // a chain on a ready future runs right away and allocates nothing, a core
+  // is only created once one is needed
+  auto before = allocations.load();
+  auto f = makeFuture(20).then([](int i){
+    return i + 1;
+  }).then([](int i){
+    return makeFuture(i * 2);
+  }).thenError([](std::exception_ptr){
+    return 0;
+  });
+  assert(f.isReady());
+  assert(std::move(f).get() == 42);
+  assert(allocations.load() == before);
+
+  auto g = makeFuture<int>(std::runtime_error("failed")).then([](int i){
+    return i + 1;
+  });
+  assert(g.hasException());
+
+  InlineExecutor executor;
+  before = allocations.load();
+  auto h = makeFuture(1).via(&executor).then([](int i){
+    return i + 1;
+  });
+  assert(allocations.load() - before >= 2);
+  assert(std::move(h).get() == 2);
+  }
+
+  {
+  // ensure() forwards the result in place, its only allocation is the
+  // downstream Core
+  auto [p, f] = makePromiseContract<int>();
+  bool ensured = false;
+  auto before = allocations.load();
+  auto f1 = std::move(f).ensure([&ensured] { ensured = true; });
+  p.setValue(5);
+  assert(allocations.load() - before == 1);
+  assert(ensured && std::move(f1).get() == 5);
+
+  auto f2 = makeFuture<int>(std::runtime_error("failed")).ensure([] {
+    throw std::logic_error("cleanup failed");
+  });
+  try {
+    std::move(f2).get();
+    assert(false);
+  } catch (const std::logic_error&) {
+  }
+  }
+
+  {
+  // values constructed in the core and read from it in place
+  auto [p, f] = makePromiseContract<std::string>();
+  p.emplaceValue(3, 'a');
+  assert(f.getRef() == "aaa");
+  f.getRef() += 'b';
+  std::string out;
+  std::move(f).getInto(out);
+  assert(out == "aaab");
+  }
+
+  {
+  // a then() returning a not yet ready future is flattened without blocking
+  auto [p1, f1] = makePromiseContract<int>();
+  auto [p2, f2] = makePromiseContract<int>();
+  auto f3 = std::move(f1).then([f2 = std::move(f2)](int i) mutable {
+    return std::move(f2).then([i](int j){
+      return i + j;
+    });
+  });
+  p1.setValue(1);
+  assert(!f3.isReady());
+  p2.setValue(2);
+  assert(std::move(f3).get() == 3);
+  }
+
+  {
+  // blocking in get() allocates nothing
+  auto [p, f] = makePromiseContract<int>();
+  std::thread t([p = std::move(p)] ()mutable{
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    p.setValue(7);
+  });
+  auto before = allocations.load();
+  assert(std::move(f).get() == 7);
+  assert(allocations.load() == before);
+  t.join();
+  }
+
+  {
+  // continuations scheduled with thenOn() leave the producer thread
+  ThreadPoolExecutor pool(2);
+  auto [p, f] = makePromiseContract<int>();
+  auto producer = std::this_thread::get_id();
+  auto f1 = std::move(f).thenOn(&pool, [producer](int i){
+    assert(std::this_thread::get_id() != producer);
+    return i + 1;
+  }).then([producer](int i){
+    assert(std::this_thread::get_id() != producer);
+    return i * 2;
+  });
+  p.setValue(1);
+  assert(std::move(f1).get() == 4);
+  }
+
+  {
+  // fan-out over a work-stealing pool
+  WorkStealingExecutor executor(4);
+  std::vector<Promise<int>> promises;
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < 1000; i++){
+    auto [p, f] = makePromiseContract<int>();
+    promises.push_back(std::move(p));
+    futures.push_back(std::move(f).thenOn(&executor, [](int i){
+      return i * 2;
+    }));
+  }
+  auto f2 = collectAll(std::move(futures)).then([](std::vector<int>&& results){
+    return std::accumulate(std::begin(results), std::end(results), 0);
+  });
+  for (int i = 0; i < 1000; i++){
+    promises[i].setValue(int(i));
+  }
+  assert(std::move(f2).get() == 999 * 1000);
+  }
+
+  {
+  // a throwing continuation fails the rest of the chain until it is recovered
+  auto [p, f] = makePromiseContract<int>();
+  bool ran = false;
+  auto f1 = std::move(f).then([](int i){
+    throw std::runtime_error("boom");
+    return i;
+  }).then([&ran](int i){
+    ran = true;
+    return i + 1;
+  }).thenError([](std::exception_ptr){
+    return -1;
+  }).thenTry([](Try<int>&& t){
+    return t.hasValue() ? t.value() * 2 : 0;
+  });
+  p.setValue(1);
+  assert(!ran);
+  assert(std::move(f1).get() == -2);
+
+  bool caught = false;
+  try {
+    makeFuture<int>(std::runtime_error("boom")).get();
+  } catch (const std::runtime_error&) {
+    caught = true;
+  }
+  assert(caught);
+  }
+
+  {
+  // dropping an unfulfilled promise breaks its future instead of hanging it
+  auto [p, f] = makePromiseContract<int>();
+  std::thread([p = std::move(p)] {}).join();
+  bool broken = false;
+  try {
+    std::move(f).get();
+  } catch (const BrokenPromise&) {
+    broken = true;
+  }
+  assert(broken);
+  }
+
+  {
+  // timed waits give up, within() fails the future instead
+  auto [p, f] = makePromiseContract<int>();
+  assert(!f.wait(std::chrono::milliseconds(10)));
+  bool timedOut = false;
+  try {
+    std::move(f).get(std::chrono::milliseconds(10));
+  } catch (const FutureTimeout&) {
+    timedOut = true;
+  }
+  assert(timedOut);
+
+  auto [p2, f2] = makePromiseContract<int>();
+  auto f3 = std::move(f2).within(std::chrono::milliseconds(10));
+  assert(f3.wait(std::chrono::seconds(5)));
+  assert(f3.hasException());
+
+  auto [p3, f4] = makePromiseContract<int>();
+  auto f5 = std::move(f4).within(std::chrono::seconds(5));
+  p3.setValue(3);
+  assert(std::move(f5).get(std::chrono::seconds(5)) == 3);
+
+  // deadlines beyond the timing wheel's reach, or the clock's, never fire
+  // early
+  auto [p4, f6] = makePromiseContract<int>();
+  auto f7 = std::move(f6).within(std::chrono::hours(24 * 365));
+  auto [p5, f8] = makePromiseContract<int>();
+  auto f9 = std::move(f8).within(std::chrono::steady_clock::duration::max());
+  assert(!f7.wait(std::chrono::milliseconds(20)) && !f9.isReady());
+  p4.setValue(4);
+  p5.setValue(5);
+  assert(std::move(f7).get() == 4 && std::move(f9).get() == 5);
+  }
+
+  {
+  // sleep() completes from the timekeeper thread
+  auto start = std::chrono::steady_clock::now();
+  futures::sleep(std::chrono::milliseconds(20)).get();
+  assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+  }
+
+  {
+  // continuations returning void produce a Future<Unit>
+  int sideEffects = 0;
+  Future<Unit> done = makeFuture()
+      .then([&](Unit) { sideEffects++; })
+      .thenTry([&](Try<Unit>&& t) { assert(t.hasValue()); sideEffects++; })
+      .then([&](Unit) -> int { throw std::runtime_error("oops"); })
+      .thenTry([&](Try<int>&& t) { assert(t.hasException()); sideEffects++; });
+  assert(done.isReady() && done.hasValue() && sideEffects == 3);
+
+  auto [p, f] = makePromiseContract<Unit>();
+  p.setValue();
+  assert(std::move(f).get() == Unit{});
+  }
+
+  {
+  // cancelling the end of a chain reaches the producer, which stops early
+  auto [p, f] = makePromiseContract<int>();
+  bool interrupted = false;
+  p.setInterruptHandler([&interrupted, &p = p](const std::exception_ptr& e) {
+    interrupted = true;
+    p.setException(e);
+  });
+  bool ran = false;
+  auto f2 = std::move(f).then([&](int i) { ran = true; return i + 1; })
+      .then([](int i) { return makeFuture(i * 2); });
+  f2.cancel();
+  assert(interrupted && !ran);
+  try {
+    std::move(f2).get();
+    assert(false);
+  } catch (const FutureCancellation&) {
+  }
+  }
+
+  {
+  // collectAny interrupts the inputs that lost
+  std::vector<Promise<int>> promises(3);
+  std::vector<Future<int>> futures;
+  int interrupts = 0;
+  for (auto& p : promises) {
+    futures.push_back(p.getFuture());
+    p.setInterruptHandler([&interrupts](const std::exception_ptr&) { interrupts++; });
+  }
+  auto any = collectAny(std::move(futures));
+  promises[1].setValue(7);
+  assert(std::move(any).get() == std::make_pair(size_t(1), 7));
+  assert(interrupts == 2);
+
+  // inputs that are ready already, held inline without a core
+  std::vector<Future<int>> ready;
+  ready.push_back(makeFuture(1));
+  ready.push_back(makeFuture(2));
+  auto [p, f] = makePromiseContract<int>();
+  ready.push_back(std::move(f));
+  assert(collectAny(std::move(ready)).get() == std::make_pair(size_t(0), 1));
+  p.setValue(3);
+
+  std::vector<Future<int>> readyN;
+  readyN.push_back(makeFuture(1));
+  readyN.push_back(makeFuture(2));
+  auto firstOne = collectN(std::move(readyN), 1, true).get();
+  assert(firstOne.size() == 1 && firstOne[0] == std::make_pair(size_t(0), 1));
+  }
+
+  {
+  // results nobody will read are released as they arrive
+  std::vector<Promise<std::shared_ptr<int>>> promises(3);
+  std::vector<Future<std::shared_ptr<int>>> futures;
+  int interrupts = 0;
+  for (auto& p : promises) {
+    futures.push_back(p.getFuture());
+    p.setInterruptHandler([&interrupts](const std::exception_ptr&) { interrupts++; });
+  }
+  auto any = collectAny(std::move(futures), false);
+  promises[0].setValue(std::make_shared<int>(0));
+  auto payload = std::make_shared<int>(1);
+  promises[1].setValue(std::shared_ptr<int>(payload));
+  assert(payload.use_count() == 1 && interrupts == 0);
+  assert(*std::move(any).get().second == 0);
+
+  std::vector<Promise<std::shared_ptr<int>>> promises2(3);
+  std::vector<Future<std::shared_ptr<int>>> futures2;
+  for (auto& p : promises2) {
+    futures2.push_back(p.getFuture());
+    p.setInterruptHandler([&interrupts](const std::exception_ptr&) { interrupts++; });
+  }
+  // unlike collectAny(), collectN() leaves the losers alone unless asked
+  auto two = collectN(std::move(futures2), 2);
+  promises2[2].setValue(std::make_shared<int>(2));
+  promises2[0].setValue(std::make_shared<int>(0));
+  promises2[1].setValue(std::shared_ptr<int>(payload));
+  assert(payload.use_count() == 1);
+  auto firstTwo = std::move(two).get();
+  assert(firstTwo.size() == 2 && firstTwo[0].first == 0 && firstTwo[1].first == 2);
+  assert(interrupts == 0);
+  }
+
+  {
+  // collectAll() completes with the last input, values need neither a
+  // default constructor nor a copy constructor
+  struct Token {
+    explicit Token(int v) : value(new int(v)) {}
+    std::unique_ptr<int> value;
+  };
+  std::vector<Promise<Token>> promises(3);
+  std::vector<Future<Token>> futures;
+  for (auto& p : promises) {
+    futures.push_back(p.getFuture());
+  }
+  auto all = collectAll(std::move(futures));
+  promises[2].setValue(Token(2));
+  promises[0].setValue(Token(0));
+  assert(!all.isReady());
+  promises[1].setValue(Token(1));
+  assert(all.isReady());
+  auto tokens = std::move(all).get();
+  for (int i = 0; i < 3; i++) {
+    assert(*tokens[i].value == i);
+  }
+
+  assert(collectAll(std::vector<Future<Token>>()).get().empty());
+  }
+
+  {
+  // futures of different types joined into a tuple
+  auto [p1, f1] = makePromiseContract<int>();
+  auto [p2, f2] = makePromiseContract<std::string>();
+  auto before = allocations.load();
+  auto both = collectAll(std::move(f1), std::move(f2));
+  assert(allocations.load() - before == 2); // the context and the result core
+  p2.setValue("admin");
+  p1.setValue(7);
+  auto [id, role] = std::move(both).get();
+  assert(id == 7 && role == "admin");
+
+  // collect() fails as soon as one input does
+  auto [p3, f3] = makePromiseContract<int>();
+  auto failed = collect(std::move(f3), makeFuture<Unit>(std::runtime_error("denied")));
+  assert(failed.isReady() && failed.hasException());
+  p3.setValue(1);
+  }
+
+  {
+  // reduce() folds in input order as values arrive, unorderedReduce() in
+  // arrival order
+  std::vector<Promise<int>> promises(4);
+  std::vector<Future<int>> futures;
+  std::vector<Future<int>> unordered;
+  for (auto& p : promises) {
+    auto f = p.getFuture();
+    FutureSplitter<int> splitter(std::move(f));
+    futures.push_back(splitter.getFuture());
+    unordered.push_back(splitter.getFuture());
+  }
+  auto digits = futures::reduce(futures.begin(), futures.end(), std::string(),
+      [](std::string acc, int v) { return acc + std::to_string(v); });
+  auto arrival = futures::unorderedReduce(unordered.begin(), unordered.end(), std::string(),
+      [](std::string acc, int v) { return acc + std::to_string(v); });
+  promises[2].setValue(2);
+  promises[0].setValue(0);
+  assert(!digits.isReady());
+  promises[3].setValue(3);
+  promises[1].setValue(1);
+  assert(std::move(digits).get() == "0123");
+  assert(std::move(arrival).get() == "2031");
+
+  std::vector<Future<int>> ready;
+  ready.push_back(makeFuture(1));
+  ready.push_back(makeFuture(2));
+  auto readySum = futures::reduce(ready.begin(), ready.end(), 0,
+      [](int acc, int v) { return acc + v; });
+  assert(std::move(readySum).get() == 3);
+
+  // the thread folding reads the values other threads produced
+  struct DeferredExecutor : Executor {
+    void add(Func func) override { queue.push_back(std::move(func)); }
+    std::vector<Func> queue;
+  } deferred;
+  auto [p0, f0] = makePromiseContract<int>();
+  auto [p1, f1] = makePromiseContract<int>();
+  std::vector<Future<int>> crossThread;
+  crossThread.push_back(std::move(f0).via(&deferred));
+  crossThread.push_back(std::move(f1));
+  auto crossSum = futures::reduce(crossThread.begin(), crossThread.end(), 0,
+      [](int acc, int v) { return acc + v; });
+  // nothing but the cores orders the two threads
+  std::atomic<bool> go{false};
+  std::thread producer([&go, p1 = std::move(p1)]() mutable {
+    while (!go.load(std::memory_order_relaxed)) {
+      std::this_thread::yield();
+    }
+    p1.setValue(2);
+  });
+  p0.setValue(1);
+  go.store(true, std::memory_order_relaxed);
+  producer.join();
+  for (auto& func : deferred.queue) {
+    func();
+  }
+  assert(std::move(crossSum).get() == 3);
+
+  // window() keeps at most two calls pending
+  std::vector<Promise<int>> pending(5);
+  int inFlight = 0;
+  int maxInFlight = 0;
+  auto results = futures::window(std::vector<int>{0, 1, 2, 3, 4}, [&](int i) {
+    maxInFlight = std::max(maxInFlight, ++inFlight);
+    return pending[i].getFuture().then([&inFlight](int v) { inFlight--; return v * 10; });
+  }, 2);
+  for (int i = 0; i < 5; i++) {
+    pending[i].setValue(int(i));
+  }
+  assert(maxInFlight == 2);
+  auto sum = futures::reduce(results.begin(), results.end(), 0,
+      [](int acc, int v) { return acc + v; });
+  assert(std::move(sum).get() == 100);
+  }
+
+  {
+  // mapBounded() never has more than maxInFlight calls pending
+  std::vector<Promise<std::string>> pending(6);
+  int inFlight = 0;
+  int maxInFlight = 0;
+  auto all = futures::mapBounded(std::vector<int>{0, 1, 2, 3, 4, 5}, 3, [&](int i) {
+    maxInFlight = std::max(maxInFlight, ++inFlight);
+    return pending[i].getFuture();
+  });
+  for (int i = 0; i < 6; i++) {
+    inFlight--;
+    pending[i].setValue(std::to_string(i));
+  }
+  assert(maxInFlight == 3);
+  auto strings = std::move(all).get();
+  assert(strings.size() == 6 && strings[0] == "0" && strings[5] == "5");
+
+  auto squares = futures::mapBounded(std::vector<int>{1, 2, 3}, 1, [](int i) { return i * i; });
+  assert(std::move(squares).get() == std::vector<int>({1, 4, 9}));
+  }
+
+  {
+  // cores from a slab pool, freed across threads
+  CorePool pool;
+  {
+    CoreAllocatorScope scope(&pool);
+    ThreadPoolExecutor executor(2);
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 1000; i++) {
+      futures.push_back(makeFuture(int(i)).via(&executor).then([](int v) { return v + 1; }));
+    }
+    auto sum = futures::reduce(futures.begin(), futures.end(), 0,
+        [](int acc, int v) { return acc + v; });
+    assert(std::move(sum).get() == 1000 * 1001 / 2);
+  }
+
+  // and from an arena released in bulk
+  CoreArena arena;
+  {
+    CoreAllocatorScope scope(&arena);
+    auto [p, f] = makePromiseContract<int>();
+    auto g = std::move(f).then([](int v) { return v * 2; });
+    assert(arena.live() == 2);
+    p.setValue(21);
+    assert(std::move(g).get() == 42);
+  }
+  assert(arena.live() == 0);
+  arena.reset();
+  }
+
+  {
+  // one computation, many consumers
+  auto [p, f] = makePromiseContract<std::string>();
+  FutureSplitter<std::string> splitter(std::move(f));
+  auto a = splitter.getFuture().then([](std::string s) { return s.size(); });
+  auto b = splitter.getFuture();
+  p.setValue("cached");
+  auto c = splitter.getFuture();
+  assert(c.isReady());
+  assert(std::move(a).get() == 6);
+  assert(std::move(b).get() == "cached" && std::move(c).get() == "cached");
+
+  // consumers racing with the producer
+  SharedPromise<int> shared;
+  std::vector<Future<int>> futures;
+  std::thread producer([&shared] { shared.setValue(42); });
+  for (int i = 0; i < 100; i++) {
+    futures.push_back(shared.getFuture());
+  }
+  producer.join();
+  for (auto& future : futures) {
+    assert(std::move(future).get() == 42);
+  }
+
+  Future<int> orphan = makeFuture(0);
+  {
+    SharedPromise<int> dropped;
+    orphan = dropped.getFuture();
+  }
+  assert(orphan.hasException());
+
+  // a waiting future costs its core and nothing more
+  SharedPromise<int> counted;
+  auto before = allocations.load();
+  auto waiting = counted.getFuture();
+  assert(allocations.load() - before == 1);
+  counted.setValue(1);
+  assert(std::move(waiting).get() == 1);
+  }
+
   auto [p, f] = makePromiseContract<int>();
 
 
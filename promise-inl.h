@@ -15,6 +15,10 @@ Promise<T>::Promise(Promise<T>&& other) noexcept
 
 template <class T>
 Promise<T>& Promise<T>::operator=(Promise<T>&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  detach();
   retrieved_ = std::exchange(other.retrieved_, false);
   core_ = std::exchange(other.core_, nullptr);
   return *this;
@@ -30,6 +34,24 @@ void Promise<T>::throwIfFulfilled() const {
 
 template <class T>
 Promise<T>::~Promise() {
+  detach();
+}
+
+
+template <class T>
+void Promise<T>::detach() noexcept {
+  if (!core_) {
+    return;
+  }
+  // the future side was never handed out, release its attach count too
+  if (!retrieved_) {
+    core_->detachFuture();
+  } else if (!core_->hasResult()) {
+    // don't leave the consumer waiting on a result that will never come
+    core_->setResult(Try<T>(std::make_exception_ptr(BrokenPromise(typeid(T).name()))));
+  }
+  core_->detachPromise();
+  core_ = nullptr;
 }
 
 
@@ -39,23 +61,52 @@ Future<T> Promise<T>::getFuture() {
     throw FutureAlreadyRetrieved();
   }
   retrieved_ = true;
-  return Future<T>(getSharedCore());
+  return Future<T>(core_);
 }
 
 
 
 template <class T>
 void Promise<T>::setValue(T&& t) {
+  throwIfFulfilled();
+  getCore().emplaceResult(std::in_place, std::move(t));
+}
+
+
+template <class T>
+template <class... Args>
+void Promise<T>::emplaceValue(Args&&... args) {
+  throwIfFulfilled();
+  getCore().emplaceResult(std::in_place, std::forward<Args>(args)...);
+}
+
+
+template <class T>
+void Promise<T>::setTry(Try<T>&& t) {
   throwIfFulfilled();
   getCore().setResult(std::move(t));
 }
 
 
+template <class T>
+void Promise<T>::setException(std::exception_ptr e) {
+  setTry(Try<T>(std::move(e)));
+}
+
+
+template <class T>
+template <class E>
+typename std::enable_if<std::is_base_of<std::exception, E>::value>::type
+Promise<T>::setException(E const& e) {
+  setException(std::make_exception_ptr(e));
+}
+
+
 template <class T>
 template <class F>
 void Promise<T>::setWith(F&& func) {
   throwIfFulfilled();
-  setValue(std::move(func()));
+  getCore().setResultWith(static_cast<F&&>(func));
 }
 
 
@@ -65,3 +116,8 @@ bool Promise<T>::isFulfilled() const noexcept {
 }
 
 
+template <class T>
+template <class F>
+void Promise<T>::setInterruptHandler(F&& handler) {
+  getCore().setInterruptHandler(static_cast<F&&>(handler));
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
 
 
 class PromiseException : public std::logic_error {
@@ -37,6 +40,9 @@ class Future;
 template <class T>
 class Promise;
 
+template <class T>
+class FutureBase;
+
 namespace detail {
   template <class T>
   class FutureBase;
@@ -63,28 +69,51 @@ public:
 
   Future<T> getFuture();
 
+  // Fulfills the promise with the result of func, or with the exception it
+  // throws.
   template <class F>
   void setWith(F&& func);
   void setValue(T&& t);
+  // Constructs the value in the core's storage from args.
+  template <class... Args>
+  void emplaceValue(Args&&... args);
+  // Completes a Promise<Unit>, which only signals completion.
+  template <class U = T>
+  typename std::enable_if<std::is_same<U, Unit>::value>::type setValue() {
+    setValue(Unit{});
+  }
+  void setTry(Try<T>&& t);
+
+  void setException(std::exception_ptr e);
+  template <class E>
+  typename std::enable_if<std::is_base_of<std::exception, E>::value>::type
+  setException(E const& e);
+
+  // Registers handler to be called with the interrupt raised by the consumer,
+  // e.g. through Future::cancel(). The producer may use it to stop early and
+  // fulfill the promise with the interrupt. handler runs at most once and may
+  // run immediately on this thread if the interrupt was already raised.
+  template <class F>
+  void setInterruptHandler(F&& handler);
 
-  
-  
 private:
+  template <class>
+  friend class FutureBase;
+
   bool retrieved_;
-  std::shared_ptr<Core<T>> core_;
+  Core<T>* core_;
 
 
   bool isFulfilled() const noexcept;
   void throwIfFulfilled() const;
+  void detach() noexcept;
 
 
-  std::shared_ptr<Core<T>> getSharedCore() {return core_;}
-
   Core<T>& getCore() { return getCoreImpl(core_); }
   const Core<T>& getCore() const { return getCoreImpl(core_); }
 
-  template <typename SharedCoreT>
-  static Core<T>& getCoreImpl(SharedCoreT& core) {
+  template <typename CoreT>
+  static Core<T>& getCoreImpl(CoreT* core) {
     if (!core) {
       throw PromiseInvalid();
     }
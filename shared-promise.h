@@ -0,0 +1,139 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <typeinfo>
+#include "core.h"
+#include "promise.h"
+#include "future.h"
+
+
+// A promise whose result is delivered to any number of futures. getFuture()
+// may be called before or after the result is set, from any thread. The
+// cores of futures handed out before the result is set wait in a lock-free
+// list linked through their own unused result storage, there is no node
+// to allocate. Each gets its own copy of the value once it arrives, the last
+// one the value itself. Later futures are created ready.
+//
+// Dropping an unfulfilled SharedPromise breaks all of its futures. Neither
+// copyable nor movable, the waiters are linked to its address.
+template <class T>
+class SharedPromise {
+  static_assert(std::is_copy_constructible<T>::value,
+      "SharedPromise hands out copies of the value");
+
+public:
+  SharedPromise() = default;
+  ~SharedPromise();
+
+  SharedPromise(const SharedPromise&) = delete;
+  SharedPromise& operator=(const SharedPromise&) = delete;
+
+  Future<T> getFuture();
+
+  template <class F>
+  void setWith(F&& func);
+  void setValue(T&& t) { setTry(Try<T>(std::move(t))); }
+  void setValue(const T& t) { setTry(Try<T>(t)); }
+  void setTry(Try<T>&& t);
+
+  void setException(std::exception_ptr e) { setTry(Try<T>(std::move(e))); }
+  template <class E>
+  typename std::enable_if<std::is_base_of<std::exception, E>::value>::type
+  setException(E const& e) {
+    setException(std::make_exception_ptr(e));
+  }
+
+  bool isFulfilled() const noexcept {
+    return head_.load(std::memory_order_acquire) == done();
+  }
+
+private:
+  // head_ is swapped to this once result_ is written
+  static Core<T>* done() noexcept { return reinterpret_cast<Core<T>*>(uintptr_t(1)); }
+
+  // fulfills a waiting core and gives up our side of it, as a Promise would
+  static void fulfill(Core<T>* core, Try<T>&& t) {
+    core->setResult(std::move(t));
+    core->detachPromise();
+  }
+
+  static Try<T> copy(const Try<T>& t) {
+    return t.hasValue() ? Try<T>(t.value()) : Try<T>(t.exception());
+  }
+
+  // waiting cores, each holds an attach count for us
+  std::atomic<Core<T>*> head_ = {nullptr};
+  std::atomic<bool> fulfilled_ = {false};
+  Try<T> result_;
+};
+
+
+template <class T>
+SharedPromise<T>::~SharedPromise() {
+  auto* core = head_.load(std::memory_order_acquire);
+  if (core == done()) {
+    return;
+  }
+  // don't leave the consumers waiting on a result that will never come
+  while (core) {
+    auto* next = core->nextPending();
+    fulfill(core, Try<T>(std::make_exception_ptr(BrokenPromise(typeid(T).name()))));
+    core = next;
+  }
+}
+
+
+template <class T>
+Future<T> SharedPromise<T>::getFuture() {
+  auto* head = head_.load(std::memory_order_acquire);
+  if (head == done()) {
+    return makeFuture(copy(result_));
+  }
+
+  // one attach count for the future, one for us
+  auto* core = Core<T>::make();
+  Future<T> f(core);
+  do {
+    if (head == done()) {
+      // lost the race with setTry()
+      fulfill(core, copy(result_));
+      return f;
+    }
+    core->setNextPending(head);
+  } while (!head_.compare_exchange_weak(
+      head, core, std::memory_order_release, std::memory_order_acquire));
+  return f;
+}
+
+
+template <class T>
+void SharedPromise<T>::setTry(Try<T>&& t) {
+  if (fulfilled_.exchange(true, std::memory_order_relaxed)) {
+    throw PromiseAlreadySatisfied();
+  }
+  // kept for the futures asked for from now on
+  result_ = copy(t);
+  auto* waiting = head_.exchange(done(), std::memory_order_acq_rel);
+
+  // the list is LIFO, fulfill in the order the futures were handed out
+  Core<T>* reversed = nullptr;
+  while (waiting) {
+    auto* next = waiting->nextPending();
+    waiting->setNextPending(reversed);
+    reversed = std::exchange(waiting, next);
+  }
+  while (reversed) {
+    auto* core = reversed;
+    reversed = core->nextPending();
+    fulfill(core, reversed ? copy(t) : std::move(t));
+  }
+}
+
+
+template <class T>
+template <class F>
+void SharedPromise<T>::setWith(F&& func) {
+  setTry(makeTryWith(static_cast<F&&>(func)));
+}
@@ -0,0 +1,218 @@
+#pragma once
+// Coroutine support, only available when compiling as C++20 with coroutines
+// enabled, see the future_coro target.
+#if __cpp_impl_coroutine
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "core-allocator.h"
+#include "core.h"
+#include "promise.h"
+#include "future.h"
+
+
+/// Awaits a Future from a coroutine. A ready Future is consumed on the
+/// spot, otherwise the coroutine suspends and is resumed from the Future's
+/// callback, on the thread completing it or on its executor. No thread
+/// blocks while waiting. Rethrows the exception the Future completed with.
+///
+///   int v = co_await std::move(future);
+template <class T>
+class FutureAwaiter {
+public:
+  explicit FutureAwaiter(Future<T>&& future) : future_(std::move(future)) {}
+
+  bool await_ready() const { return future_.isReady(); }
+
+  bool await_suspend(std::coroutine_handle<> caller) {
+    caller_ = caller;
+    future_.setCallback_([this](Try<T>&& t) {
+      result_ = std::move(t);
+      // whoever comes second resumes, the callback may run before
+      // await_suspend returns
+      if (done_.exchange(true, std::memory_order_acq_rel)) {
+        caller_.resume();
+      }
+    });
+    return !done_.exchange(true, std::memory_order_acq_rel);
+  }
+
+  T await_resume() {
+    if (!result_.hasValue() && !result_.hasException()) {
+      return std::move(future_).get();
+    }
+    return std::move(result_).value();
+  }
+
+private:
+  Future<T> future_;
+  Try<T> result_;
+  std::coroutine_handle<> caller_;
+  std::atomic<bool> done_ = {false};
+};
+
+template <class T>
+FutureAwaiter<T> operator co_await(Future<T>&& future) {
+  return FutureAwaiter<T>(std::move(future));
+}
+
+
+template <class T>
+class Task;
+
+namespace detail {
+
+// Frames of Task coroutines are recycled through a slab pool of their own,
+// per thread like cores are. Never destroyed, frames may still be freed
+// while statics are torn down.
+inline CorePool& taskFramePool() {
+  static CorePool* pool = new CorePool;
+  return *pool;
+}
+
+template <class T>
+struct TaskResult {
+  template <class U = T>
+  void return_value(U&& value) {
+    result_ = Try<T>(std::in_place, std::forward<U>(value));
+  }
+
+  Try<T> result_;
+};
+
+// a Task<Unit> ends with a plain co_return
+template <>
+struct TaskResult<Unit> {
+  void return_void() { result_ = Try<Unit>(Unit{}); }
+
+  Try<Unit> result_;
+};
+
+template <class T>
+struct TaskPromise : TaskResult<T> {
+  using Handle = std::coroutine_handle<TaskPromise>;
+
+  // Resumes whoever awaits the task, or completes the promise of a started
+  // task and frees the frame.
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(Handle h) noexcept {
+      auto& self = h.promise();
+      if (!self.started_) {
+        return self.continuation_ ? self.continuation_ : std::noop_coroutine();
+      }
+      auto promise = std::move(*self.started_);
+      auto result = std::move(self.result_);
+      h.destroy();
+      promise.setTry(std::move(result));
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  static void* operator new(std::size_t size) {
+    return taskFramePool().allocate(size);
+  }
+  static void operator delete(void* p, std::size_t size) noexcept {
+    taskFramePool().deallocate(p, size);
+  }
+
+  Task<T> get_return_object() noexcept { return Task<T>(Handle::from_promise(*this)); }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() noexcept {
+    this->result_ = Try<T>(std::current_exception());
+  }
+
+  std::coroutine_handle<> continuation_;
+  // set by Task::start()
+  std::optional<Promise<T>> started_;
+};
+
+}
+
+
+/// A lazily started coroutine producing a T. Nothing runs until the Task is
+/// awaited from another coroutine, which resumes right after it without a
+/// Core or callback in between, or converted to a Future by start().
+/// Return Task<Unit> from a coroutine that ends with a plain co_return.
+/// Frames are recycled by a pool instead of going to global new.
+///
+///   Task<int> handle(Request r) {
+///     auto user = co_await loadUser(r.id);   // Future<User>
+///     auto quota = co_await checkQuota(user); // Task<int>
+///     co_return quota;
+///   }
+template <class T>
+class Task {
+public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() { reset(); }
+
+  /// Runs the coroutine on this thread up to its first suspension and
+  /// returns a Future for its result. The frame frees itself once the
+  /// coroutine completes.
+  Future<T> start() && {
+    if (!handle_) {
+      throw FutureInvalid();
+    }
+    auto& promise = handle_.promise();
+    promise.started_.emplace();
+    auto f = promise.started_->getFuture();
+    std::exchange(handle_, {}).resume();
+    return f;
+  }
+
+  operator Future<T>() && { return std::move(*this).start(); }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return false; }
+      // run the task right away, it resumes the awaiting coroutine when done
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation_ = caller;
+        return handle;
+      }
+      T await_resume() { return std::move(handle.promise().result_).value(); }
+
+      typename promise_type::Handle handle;
+    };
+    return Awaiter{handle_};
+  }
+
+private:
+  friend promise_type;
+
+  explicit Task(typename promise_type::Handle handle) noexcept : handle_(handle) {}
+
+  void reset() noexcept {
+    if (handle_) {
+      std::exchange(handle_, {}).destroy();
+    }
+  }
+
+  typename promise_type::Handle handle_;
+};
+
+#endif
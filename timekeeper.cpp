@@ -0,0 +1,306 @@
+#include "timekeeper.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <vector>
+
+
+Timekeeper& getTimekeeper() {
+  static WheelTimekeeper timekeeper;
+  return timekeeper;
+}
+
+
+ThreadTimekeeper::ThreadTimekeeper()
+    : nextId_(1), stopping_(false), thread_([this] { run(); }) {}
+
+ThreadTimekeeper::~ThreadTimekeeper() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+uint64_t ThreadTimekeeper::schedule(Clock::duration delay, Callback callback) {
+  auto deadline = Clock::now() + delay;
+  bool earliest;
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    id = nextId_++;
+    earliest = timers_.empty() || deadline < timers_.begin()->first.first;
+    timers_.emplace(Key(deadline, id), std::move(callback));
+    deadlines_.emplace(id, deadline);
+  }
+  if (earliest) {
+    cv_.notify_one();
+  }
+  return id;
+}
+
+bool ThreadTimekeeper::cancel(uint64_t id) {
+  Callback callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = deadlines_.find(id);
+    if (it == deadlines_.end()) {
+      return false;
+    }
+    auto timer = timers_.find(Key(it->second, id));
+    callback = std::move(timer->second);
+    timers_.erase(timer);
+    deadlines_.erase(it);
+  }
+  // the callback is destroyed outside of the lock
+  return true;
+}
+
+void ThreadTimekeeper::run() {
+  std::vector<Callback> due;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    if (timers_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+    auto deadline = timers_.begin()->first.first;
+    if (Clock::now() < deadline) {
+      cv_.wait_until(lock, deadline);
+      continue;
+    }
+
+    auto now = Clock::now();
+    while (!timers_.empty() && timers_.begin()->first.first <= now) {
+      auto it = timers_.begin();
+      deadlines_.erase(it->first.second);
+      due.push_back(std::move(it->second));
+      timers_.erase(it);
+    }
+    lock.unlock();
+    for (auto& callback : due) {
+      callback();
+    }
+    due.clear();
+    lock.lock();
+  }
+}
+
+
+WheelTimekeeper::WheelTimekeeper(std::chrono::microseconds tick)
+    : tick_(std::chrono::duration_cast<Clock::duration>(tick)),
+      start_(Clock::now()),
+      freeList_(kNil),
+      count_(0),
+      currentTick_(0),
+      wakeTick_(0),
+      stopping_(false) {
+  for (auto& level : slots_) {
+    std::fill(std::begin(level), std::end(level), kNil);
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+WheelTimekeeper::~WheelTimekeeper() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+uint64_t WheelTimekeeper::tickOf(Clock::time_point t) const {
+  return uint64_t((t - start_) / tick_);
+}
+
+WheelTimekeeper::Clock::time_point WheelTimekeeper::timeOf(uint64_t tick) const {
+  return start_ + tick_ * tick;
+}
+
+uint64_t WheelTimekeeper::schedule(Clock::duration delay, Callback callback) {
+  auto now = Clock::now();
+  // round up so that a timer never fires early, a deadline past the clock's
+  // range is as good as never
+  auto expire = delay >= Clock::time_point::max() - now - tick_
+      ? UINT64_MAX
+      : uint64_t((now + delay - start_ + tick_ - Clock::duration(1)) / tick_);
+  bool wake;
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+      // the wheel is empty, skip the idle ticks instead of replaying them
+      currentTick_ = std::max(currentTick_, tickOf(now));
+    }
+
+    uint32_t index;
+    if (freeList_ != kNil) {
+      index = freeList_;
+      freeList_ = nodes_[index].next;
+    } else {
+      index = uint32_t(nodes_.size());
+      nodes_.emplace_back();
+    }
+    auto& node = nodes_[index];
+    node.callback = std::move(callback);
+    node.expire = std::max(expire, currentTick_ + 1);
+    node.armed = true;
+    link(index, currentTick_);
+    ++count_;
+
+    id = (uint64_t(node.generation) << 32) | index;
+    wake = node.expire < wakeTick_;
+  }
+  if (wake) {
+    cv_.notify_one();
+  }
+  return id;
+}
+
+bool WheelTimekeeper::cancel(uint64_t id) {
+  auto index = uint32_t(id);
+  auto generation = uint32_t(id >> 32);
+  Callback callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= nodes_.size()) {
+      return false;
+    }
+    auto& node = nodes_[index];
+    if (!node.armed || node.generation != generation) {
+      return false;
+    }
+    unlink(index);
+    callback = std::move(node.callback);
+    release(index);
+  }
+  // the callback is destroyed outside of the lock
+  return true;
+}
+
+void WheelTimekeeper::link(uint32_t index, uint64_t current) {
+  auto& node = nodes_[index];
+  auto delta = node.expire - current;
+  uint32_t level = 0;
+  while (level + 1 < kLevels && delta >= (uint64_t(1) << (kSlotBits * (level + 1)))) {
+    ++level;
+  }
+  // beyond the wheel's reach, wait in the farthest top level slot and go
+  // round again when it is cascaded, the deadline is kept as it is
+  auto placed = delta >= (uint64_t(1) << (kSlotBits * kLevels))
+      ? current + (uint64_t(1) << (kSlotBits * kLevels)) - 1
+      : node.expire;
+  auto slot = uint32_t(placed >> (kSlotBits * level)) & kSlotMask;
+
+  node.level = uint8_t(level);
+  node.slot = uint8_t(slot);
+  node.prev = kNil;
+  node.next = slots_[level][slot];
+  if (node.next != kNil) {
+    nodes_[node.next].prev = index;
+  }
+  slots_[level][slot] = index;
+}
+
+void WheelTimekeeper::unlink(uint32_t index) {
+  auto& node = nodes_[index];
+  if (node.prev != kNil) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    slots_[node.level][node.slot] = node.next;
+  }
+  if (node.next != kNil) {
+    nodes_[node.next].prev = node.prev;
+  }
+}
+
+void WheelTimekeeper::release(uint32_t index) {
+  auto& node = nodes_[index];
+  node.armed = false;
+  if (++node.generation == 0) {
+    node.generation = 1;
+  }
+  node.next = freeList_;
+  freeList_ = index;
+  --count_;
+}
+
+void WheelTimekeeper::cascade(uint32_t level, uint64_t tick) {
+  auto slot = uint32_t(tick >> (kSlotBits * level)) & kSlotMask;
+  auto index = std::exchange(slots_[level][slot], kNil);
+  while (index != kNil) {
+    auto next = nodes_[index].next;
+    link(index, tick);
+    index = next;
+  }
+}
+
+void WheelTimekeeper::processTick(uint64_t tick, std::vector<Callback>& due) {
+  // move timers of the block starting at this tick down a level, highest
+  // level first
+  for (uint32_t level = kLevels - 1; level > 0; --level) {
+    if ((tick & ((uint64_t(1) << (kSlotBits * level)) - 1)) == 0) {
+      cascade(level, tick);
+    }
+  }
+
+  auto index = std::exchange(slots_[0][tick & kSlotMask], kNil);
+  while (index != kNil) {
+    auto& node = nodes_[index];
+    auto next = node.next;
+    assert(node.expire == tick);
+    due.push_back(std::move(node.callback));
+    release(index);
+    index = next;
+  }
+}
+
+uint64_t WheelTimekeeper::nextWakeTick() const {
+  if (count_ == 0) {
+    return UINT64_MAX;
+  }
+  // the next non-empty slot of the lowest level, or the next cascade
+  auto boundary = ((currentTick_ >> kSlotBits) + 1) << kSlotBits;
+  for (auto tick = currentTick_ + 1; tick < boundary; ++tick) {
+    if (slots_[0][tick & kSlotMask] != kNil) {
+      return tick;
+    }
+  }
+  return boundary;
+}
+
+void WheelTimekeeper::run() {
+  std::vector<Callback> due;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    auto now = tickOf(Clock::now());
+    while (currentTick_ < now) {
+      if (count_ == 0) {
+        currentTick_ = now;
+        break;
+      }
+      processTick(++currentTick_, due);
+    }
+
+    if (!due.empty()) {
+      lock.unlock();
+      for (auto& callback : due) {
+        callback();
+      }
+      due.clear();
+      lock.lock();
+      continue;
+    }
+
+    wakeTick_ = nextWakeTick();
+    if (wakeTick_ == UINT64_MAX) {
+      cv_.wait(lock);
+    } else {
+      cv_.wait_until(lock, timeOf(wakeTick_));
+    }
+    // awake, schedule() need not notify
+    wakeTick_ = 0;
+  }
+}
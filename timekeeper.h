@@ -0,0 +1,116 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "function.h"
+
+
+// Runs callbacks after a delay on a background thread.
+class Timekeeper {
+public:
+  using Callback = Function<void()>;
+  using Clock = std::chrono::steady_clock;
+
+  virtual ~Timekeeper() {}
+
+  // Runs callback once `delay` has elapsed. Returns an id for cancel().
+  virtual uint64_t schedule(Clock::duration delay, Callback callback) = 0;
+
+  // Returns true if the timer was cancelled before it fired.
+  virtual bool cancel(uint64_t id) = 0;
+};
+
+// The process-wide timekeeper used when none is passed explicitly.
+Timekeeper& getTimekeeper();
+
+
+// Keeps timers ordered by deadline in a map, O(log n) schedule and cancel.
+class ThreadTimekeeper : public Timekeeper {
+public:
+  ThreadTimekeeper();
+  ~ThreadTimekeeper() override;
+
+  ThreadTimekeeper(const ThreadTimekeeper&) = delete;
+  ThreadTimekeeper& operator=(const ThreadTimekeeper&) = delete;
+
+  uint64_t schedule(Clock::duration delay, Callback callback) override;
+  bool cancel(uint64_t id) override;
+
+private:
+  using Key = std::pair<Clock::time_point, uint64_t>;
+
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<Key, Callback> timers_;
+  std::unordered_map<uint64_t, Clock::time_point> deadlines_;
+  uint64_t nextId_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+
+// Hashed hierarchical timing wheel driven by one background thread. Four
+// levels of 256 slots cover 2^32 ticks, timers further out go round the top
+// level again until they are in reach. Timer nodes live in one vector linked
+// by index, so schedule and cancel are O(1) and need no allocation once the
+// vector has grown to the peak number of outstanding timers.
+class WheelTimekeeper : public Timekeeper {
+public:
+  explicit WheelTimekeeper(std::chrono::microseconds tick = std::chrono::milliseconds(1));
+  ~WheelTimekeeper() override;
+
+  WheelTimekeeper(const WheelTimekeeper&) = delete;
+  WheelTimekeeper& operator=(const WheelTimekeeper&) = delete;
+
+  uint64_t schedule(Clock::duration delay, Callback callback) override;
+  bool cancel(uint64_t id) override;
+
+private:
+  static constexpr uint32_t kLevels = 4;
+  static constexpr uint32_t kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  static constexpr uint32_t kSlotMask = kSlots - 1;
+  static constexpr uint32_t kNil = UINT32_MAX;
+
+  struct Node {
+    Callback callback;
+    uint64_t expire = 0;
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    uint32_t generation = 1;
+    uint8_t level = 0;
+    uint8_t slot = 0;
+    bool armed = false;
+  };
+
+  uint64_t tickOf(Clock::time_point t) const;
+  Clock::time_point timeOf(uint64_t tick) const;
+  void link(uint32_t index, uint64_t current);
+  void unlink(uint32_t index);
+  void release(uint32_t index);
+  void cascade(uint32_t level, uint64_t tick);
+  void processTick(uint64_t tick, std::vector<Callback>& due);
+  uint64_t nextWakeTick() const;
+  void run();
+
+  const Clock::duration tick_;
+  const Clock::time_point start_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Node> nodes_;
+  uint32_t freeList_;
+  uint32_t slots_[kLevels][kSlots];
+  size_t count_;
+  uint64_t currentTick_; // last processed tick
+  uint64_t wakeTick_; // tick the background thread sleeps until
+  bool stopping_;
+  std::thread thread_;
+};
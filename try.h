@@ -0,0 +1,259 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "unit.h"
+
+
+class TryException : public std::logic_error {
+ public:
+  using std::logic_error::logic_error;
+};
+
+class UsingUninitializedTry : public TryException {
+ public:
+  UsingUninitializedTry() : TryException("Using uninitialized try") {}
+};
+
+
+// Selects the Try constructors that store the value returned by a callable.
+// The value is constructed in place from the returned prvalue, with no
+// temporary to move from.
+struct TryInvokeTag {};
+
+
+// Holds either a value of type T, an exception, or nothing at all. This is the
+// result stored in a Core and handed to callbacks, so a failed computation
+// travels down a then() chain without throwing at every hop. Move only.
+template <class T>
+class Try {
+  static_assert(!std::is_reference<T>::value, "Try may not be used with reference types");
+
+public:
+  using element_type = T;
+
+  Try() noexcept : contains_(Contains::Nothing) {}
+
+  explicit Try(const T& v) : contains_(Contains::Value) {
+    new (&value_) T(v);
+  }
+  explicit Try(T&& v) : contains_(Contains::Value) {
+    new (&value_) T(std::move(v));
+  }
+  template <typename... Args>
+  explicit Try(std::in_place_t, Args&&... args) : contains_(Contains::Value) {
+    new (&value_) T(static_cast<Args&&>(args)...);
+  }
+  explicit Try(std::exception_ptr e) noexcept : contains_(Contains::Exception) {
+    new (&exception_) std::exception_ptr(std::move(e));
+  }
+  // Exceptions thrown by func propagate.
+  template <typename F>
+  Try(TryInvokeTag, F&& func) : contains_(Contains::Value) {
+    new (&value_) T(static_cast<F&&>(func)());
+  }
+
+  Try(Try&& other) noexcept(std::is_nothrow_move_constructible<T>::value)
+      : contains_(other.contains_) {
+    if (contains_ == Contains::Value) {
+      new (&value_) T(std::move(other.value_));
+    } else if (contains_ == Contains::Exception) {
+      new (&exception_) std::exception_ptr(std::move(other.exception_));
+    }
+  }
+
+  Try& operator=(Try&& other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+    if (this == &other) {
+      return *this;
+    }
+    destroy();
+    if (other.contains_ == Contains::Value) {
+      new (&value_) T(std::move(other.value_));
+    } else if (other.contains_ == Contains::Exception) {
+      new (&exception_) std::exception_ptr(std::move(other.exception_));
+    }
+    contains_ = other.contains_;
+    return *this;
+  }
+
+  ~Try() { destroy(); }
+
+  bool hasValue() const noexcept { return contains_ == Contains::Value; }
+  bool hasException() const noexcept { return contains_ == Contains::Exception; }
+
+  // Returns the value, rethrows the exception if there is one.
+  T& value() & {
+    throwIfFailed();
+    return value_;
+  }
+  const T& value() const& {
+    throwIfFailed();
+    return value_;
+  }
+  T&& value() && {
+    throwIfFailed();
+    return std::move(value_);
+  }
+  const T&& value() const&& {
+    throwIfFailed();
+    return std::move(value_);
+  }
+
+  T& operator*() & { return value(); }
+  T&& operator*() && { return std::move(value()); }
+  T* operator->() { return &value(); }
+
+  std::exception_ptr& exception() & {
+    assert(hasException());
+    return exception_;
+  }
+  const std::exception_ptr& exception() const& {
+    assert(hasException());
+    return exception_;
+  }
+  std::exception_ptr&& exception() && {
+    assert(hasException());
+    return std::move(exception_);
+  }
+
+  void throwIfFailed() const {
+    switch (contains_) {
+      case Contains::Value:
+        return;
+      case Contains::Exception:
+        std::rethrow_exception(exception_);
+      default:
+        throw UsingUninitializedTry();
+    }
+  }
+
+private:
+  enum class Contains : uint8_t {
+    Value,
+    Exception,
+    Nothing,
+  };
+
+  void destroy() noexcept {
+    if (contains_ == Contains::Value) {
+      value_.~T();
+    } else if (contains_ == Contains::Exception) {
+      exception_.~exception_ptr();
+    }
+    contains_ = Contains::Nothing;
+  }
+
+  Contains contains_;
+  union {
+    T value_;
+    std::exception_ptr exception_;
+  };
+};
+
+
+// Unit carries no data. It is an empty base here, so a Try<Unit> stores only
+// the exception and whether it holds a value.
+template <>
+class Try<Unit> : private Unit {
+public:
+  using element_type = Unit;
+
+  Try() noexcept : hasValue_(false) {}
+  explicit Try(Unit) noexcept : hasValue_(true) {}
+  explicit Try(std::in_place_t) noexcept : hasValue_(true) {}
+  Try(std::in_place_t, Unit) noexcept : hasValue_(true) {}
+  // func may return Unit or void.
+  template <typename F>
+  Try(TryInvokeTag, F&& func) : hasValue_(false) {
+    static_cast<F&&>(func)();
+    hasValue_ = true;
+  }
+  explicit Try(std::exception_ptr e) noexcept
+      : hasValue_(false), exception_(std::move(e)) {}
+
+  Try(Try&& other) noexcept
+      : hasValue_(std::exchange(other.hasValue_, false)),
+        exception_(std::move(other.exception_)) {}
+
+  Try& operator=(Try&& other) noexcept {
+    hasValue_ = std::exchange(other.hasValue_, false);
+    exception_ = std::move(other.exception_);
+    return *this;
+  }
+
+  bool hasValue() const noexcept { return hasValue_; }
+  bool hasException() const noexcept { return bool(exception_); }
+
+  Unit& value() & {
+    throwIfFailed();
+    return *this;
+  }
+  const Unit& value() const& {
+    throwIfFailed();
+    return *this;
+  }
+  Unit&& value() && {
+    throwIfFailed();
+    return std::move(*this);
+  }
+  const Unit&& value() const&& {
+    throwIfFailed();
+    return std::move(*this);
+  }
+
+  Unit& operator*() & { return value(); }
+  Unit&& operator*() && { return std::move(value()); }
+  Unit* operator->() { return &value(); }
+
+  std::exception_ptr& exception() & {
+    assert(hasException());
+    return exception_;
+  }
+  const std::exception_ptr& exception() const& {
+    assert(hasException());
+    return exception_;
+  }
+  std::exception_ptr&& exception() && {
+    assert(hasException());
+    return std::move(exception_);
+  }
+
+  void throwIfFailed() const {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+    if (!hasValue_) {
+      throw UsingUninitializedTry();
+    }
+  }
+
+private:
+  bool hasValue_;
+  std::exception_ptr exception_;
+};
+
+static_assert(sizeof(Try<Unit>) <= sizeof(Try<char>), "Unit must not add to the size of a Try");
+
+
+template <typename T>
+struct isTry : std::false_type {};
+
+template <typename T>
+struct isTry<Try<T>> : std::true_type {};
+
+
+// Calls func and captures its result or the exception it throws. A void
+// result becomes a Try<Unit>.
+template <typename F>
+Try<LiftUnit_t<std::invoke_result_t<F>>> makeTryWith(F&& func) {
+  using T = LiftUnit_t<std::invoke_result_t<F>>;
+  try {
+    return Try<T>(TryInvokeTag(), static_cast<F&&>(func));
+  } catch (...) {
+    return Try<T>(std::current_exception());
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+
+// Value type of futures that only signal completion, use it instead of void.
+struct Unit {
+  constexpr bool operator==(const Unit&) const { return true; }
+  constexpr bool operator!=(const Unit&) const { return false; }
+};
+
+// Maps void to Unit, so continuations returning void produce a Future<Unit>.
+template <typename T>
+struct LiftUnit {
+  using type = T;
+};
+
+template <>
+struct LiftUnit<void> {
+  using type = Unit;
+};
+
+template <typename T>
+using LiftUnit_t = typename LiftUnit<T>::type;
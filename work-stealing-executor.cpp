@@ -0,0 +1,173 @@
+#include "work-stealing-executor.h"
+#include <cassert>
+#include <new>
+
+
+namespace {
+struct CurrentWorker {
+  WorkStealingExecutor* executor = nullptr;
+  size_t index = 0;
+};
+thread_local CurrentWorker currentWorker;
+
+uint64_t nextRandom(uint64_t& seed) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+}
+
+
+WorkStealingExecutor::WorkStealingExecutor(size_t numThreads)
+    : nextInbox_(0),
+      epoch_(0),
+      sleepers_(0),
+      pending_(0),
+      stopping_(false) {
+  assert(numThreads > 0);
+  workers_.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+  threads_.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i) {
+    threads_.emplace_back([this, i] { run(i); });
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  join();
+}
+
+void WorkStealingExecutor::add(Func func) {
+  pending_.fetch_add(1, std::memory_order_seq_cst);
+
+  if (currentWorker.executor == this) {
+    workers_[currentWorker.index]->deque.push(makeTask(std::move(func)));
+  } else {
+    if (stopping_.load(std::memory_order_seq_cst)) {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      func();
+      return;
+    }
+    auto& worker = *workers_[nextInbox_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+    auto* task = makeTask(std::move(func));
+    std::lock_guard<std::mutex> lock(worker.inboxMutex);
+    worker.inbox.push_back(task);
+    worker.inboxSize.fetch_add(1, std::memory_order_release);
+  }
+
+  if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+    notify();
+  }
+}
+
+void WorkStealingExecutor::join() {
+  if (stopping_.exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    ++epoch_;
+  }
+  sleepCv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+
+  // functions added while the workers were shutting down
+  for (auto& worker : workers_) {
+    while (Func* func = popInbox(*worker)) {
+      runTask(func);
+    }
+  }
+}
+
+void WorkStealingExecutor::notify() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    ++epoch_;
+  }
+  sleepCv_.notify_one();
+}
+
+Executor::Func* WorkStealingExecutor::makeTask(Func&& func) {
+  return ::new (tasks_.allocate(sizeof(Func))) Func(std::move(func));
+}
+
+void WorkStealingExecutor::runTask(Func* func) {
+  (*func)();
+  func->~Func();
+  tasks_.deallocate(func, sizeof(Func));
+}
+
+Executor::Func* WorkStealingExecutor::popInbox(Worker& worker) {
+  if (worker.inboxSize.load(std::memory_order_acquire) == 0) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(worker.inboxMutex);
+  if (worker.inbox.empty()) {
+    return nullptr;
+  }
+  Func* func = worker.inbox.front();
+  worker.inbox.pop_front();
+  worker.inboxSize.fetch_sub(1, std::memory_order_relaxed);
+  return func;
+}
+
+Executor::Func* WorkStealingExecutor::findWork(size_t index, uint64_t& seed) {
+  if (Func* func = workers_[index]->deque.take()) {
+    return func;
+  }
+  if (Func* func = popInbox(*workers_[index])) {
+    return func;
+  }
+  auto n = workers_.size();
+  auto start = nextRandom(seed) % n;
+  for (size_t i = 0; i < n; ++i) {
+    auto victim = (start + i) % n;
+    if (victim == index) {
+      continue;
+    }
+    if (Func* func = workers_[victim]->deque.steal()) {
+      return func;
+    }
+    if (Func* func = popInbox(*workers_[victim])) {
+      return func;
+    }
+  }
+  return nullptr;
+}
+
+void WorkStealingExecutor::run(size_t index) {
+  currentWorker.executor = this;
+  currentWorker.index = index;
+  uint64_t seed = index + 1;
+
+  while (true) {
+    if (Func* func = findWork(index, seed)) {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      runTask(func);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    auto epoch = epoch_;
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    if (pending_.load(std::memory_order_seq_cst) > 0) {
+      // something is queued or about to be, look again
+      sleepers_.fetch_sub(1, std::memory_order_relaxed);
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (stopping_.load(std::memory_order_seq_cst)) {
+      sleepers_.fetch_sub(1, std::memory_order_relaxed);
+      return;
+    }
+    sleepCv_.wait(lock, [&] { return epoch_ != epoch; });
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
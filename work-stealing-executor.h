@@ -0,0 +1,171 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "core-allocator.h"
+#include "executor.h"
+
+
+// Chase-Lev work-stealing deque. Only the owning thread may push() and take()
+// (LIFO at the bottom), any thread may steal() (FIFO from the top). The
+// capacity must be a power of two, the deque grows when it is full.
+template <typename T>
+class WorkStealingDeque {
+public:
+  explicit WorkStealingDeque(int64_t capacity = 256)
+      : top_(0), bottom_(0), array_(new Array(capacity)) {}
+
+  ~WorkStealingDeque() {
+    delete array_.load(std::memory_order_relaxed);
+    for (auto* array : retired_) {
+      delete array;
+    }
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  void push(T* item) {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_acquire);
+    auto* a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      a = grow(a, t, b);
+    }
+    a->put(b, item);
+    bottom_.store(b + 1, std::memory_order_release);
+  }
+
+  T* take() {
+    auto b = bottom_.load(std::memory_order_relaxed) - 1;
+    auto* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = a->get(b);
+    if (t == b) {
+      // last item, race against thieves for it
+      if (!top_.compare_exchange_strong(
+              t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  T* steal() {
+    auto t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    auto* a = array_.load(std::memory_order_acquire);
+    T* item = a->get(t);
+    if (!top_.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  bool empty() const {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+private:
+  struct Array {
+    explicit Array(int64_t c)
+        : capacity(c), mask(c - 1), slots(new std::atomic<T*>[c]) {}
+
+    void put(int64_t i, T* item) {
+      slots[i & mask].store(item, std::memory_order_release);
+    }
+    T* get(int64_t i) { return slots[i & mask].load(std::memory_order_acquire); }
+
+    int64_t capacity;
+    int64_t mask;
+    std::unique_ptr<std::atomic<T*>[]> slots;
+  };
+
+  Array* grow(Array* a, int64_t t, int64_t b) {
+    auto* bigger = new Array(a->capacity * 2);
+    for (auto i = t; i != b; ++i) {
+      bigger->put(i, a->get(i));
+    }
+    // thieves may still be reading the old array, keep it until destruction
+    retired_.push_back(a);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  alignas(64) std::atomic<int64_t> top_;
+  alignas(64) std::atomic<int64_t> bottom_;
+  std::atomic<Array*> array_;
+  std::vector<Array*> retired_;
+};
+
+
+// Thread pool where each worker owns a WorkStealingDeque. Functions added from
+// a worker go to its own deque and are run LIFO, functions added from other
+// threads are dealt round robin to the workers' inboxes, so submitters only
+// contend on one worker's lock. Idle workers steal from the other workers'
+// deques and inboxes before going to sleep. Queued functions live in blocks
+// recycled through a pool of the executor's own rather than in global new.
+class WorkStealingExecutor : public Executor {
+public:
+  explicit WorkStealingExecutor(size_t numThreads);
+  ~WorkStealingExecutor() override;
+
+  WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+  void add(Func func) override;
+
+  // Runs all queued functions and joins the threads. Functions added
+  // afterwards run inline.
+  void join();
+
+private:
+  struct Worker {
+    WorkStealingDeque<Func> deque;
+    // functions added from outside the pool
+    std::mutex inboxMutex;
+    std::deque<Func*> inbox;
+    std::atomic<size_t> inboxSize = {0};
+  };
+
+  void run(size_t index);
+  Func* findWork(size_t index, uint64_t& seed);
+  static Func* popInbox(Worker& worker);
+  Func* makeTask(Func&& func);
+  void runTask(Func* func);
+  void notify();
+
+  // declared first, the blocks of queued functions must outlive the queues
+  CorePool tasks_;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> nextInbox_;
+
+  std::mutex sleepMutex_;
+  std::condition_variable sleepCv_;
+  uint64_t epoch_;
+  std::atomic<size_t> sleepers_;
+  std::atomic<size_t> pending_;
+  std::atomic<bool> stopping_;
+};